@@ -0,0 +1,213 @@
+/*
+   bench - benchmark harness of the ushuffle command-line tool.
+
+   Released under the same license as uShuffle (see README).
+ */
+
+/*
+ *	bench.c - shuffle1/shuffle2 benchmark sweeps
+ */
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "ushuffle.h"
+#include "bench.h"
+#include "units.h"
+
+static double now_ns() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static long peak_rss_kb() {
+	struct rusage r;
+
+	getrusage(RUSAGE_SELF, &r);
+	return r.ru_maxrss;
+}
+
+static void *xmalloc(size_t size) {
+	void *mem;
+
+	if ((mem = malloc(size)) == NULL) {
+		fprintf(stderr, "malloc of %zu bytes failed\n", size);
+		exit(1);
+	}
+	return mem;
+}
+
+/* next comma separated item of *list, NULL at the end */
+static char *next_item(char **list) {
+	char *item = *list;
+
+	if (item == NULL || *item == '\0')
+		return NULL;
+	if ((*list = strchr(item, ',')) != NULL)
+		*(*list)++ = '\0';
+	return item;
+}
+
+static long parse_length(const char *s) {
+	long v = units_length(s, NULL);
+
+	if (v < 1) {
+		fprintf(stderr, "invalid benchmark length: %s\n", s);
+		exit(1);
+	}
+	return v;
+}
+
+/* the longest length of the -L list */
+static long max_length(const char *lengths) {
+	char *list = strdup(lengths), *p = list, *item;
+	long l, max = 0;
+
+	while ((item = next_item(&p)) != NULL)
+		if ((l = parse_length(item)) > max)
+			max = l;
+	free(list);
+	return max;
+}
+
+/* sequence of a FASTA (single or multi-line) or plain text file */
+static char *read_file(const char *path, long *len) {
+	FILE *f;
+	char *line = NULL, *s = NULL;
+	size_t line_alloc = 0;
+	long l = 0, alloc = 0;
+	ssize_t n;
+	ssize_t i;
+
+	if ((f = fopen(path, "r")) == NULL) {
+		fprintf(stderr, "can't open %s: %m\n", path);
+		exit(1);
+	}
+	while ((n = getline(&line, &line_alloc, f)) != -1) {
+		if (line[0] == '>')
+			continue;
+		if (l + n + 1 > alloc) {
+			alloc = 2 * (l + n + 1);
+			if ((s = realloc(s, alloc)) == NULL) {
+				fprintf(stderr, "realloc failed\n");
+				exit(1);
+			}
+		}
+		for (i = 0; i < n; i++)
+			if (!isspace((unsigned char) line[i]))
+				s[l++] = line[i];
+	}
+	fclose(f);
+	free(line);
+	if (l == 0) {
+		fprintf(stderr, "no sequence in %s\n", path);
+		exit(1);
+	}
+	s[l] = '\0';
+	*len = l;
+	return s;
+}
+
+static char *synthesize(const char *alphabet, long l) {
+	char *s = xmalloc(l + 1);
+	long i, a = strlen(alphabet);
+
+	for (i = 0; i < l; i++)
+		s[i] = alphabet[random() % a];
+	s[l] = '\0';
+	return s;
+}
+
+static void run(const char *source, const char *s, long l, int k, int n) {
+	char *t = xmalloc(l + 1);
+	double t0, t1, t2, s1, s2;
+	shuffle_mem mem;
+	int i;
+
+	t0 = now_ns();
+	shuffle1(s, l, k);
+	t1 = now_ns();
+	for (i = 0; i < n; i++)
+		shuffle2(t);
+	t2 = now_ns();
+	shuffle_memstats(&mem);
+	shuffle_reset();
+	free(t);
+
+	s1 = t1 - t0;
+	s2 = (t2 - t1) / n;
+	printf("{\"source\":\"%s\",\"length\":%ld,\"k\":%d,\"permutations\":%d,"
+			"\"index_bits\":%d,\"vertices\":%ld,"
+			"\"shuffle1_ms\":%.3f,\"shuffle2_ms_per_permutation\":%.3f,"
+			"\"shuffle1_ns_per_base\":%.3f,\"shuffle2_ns_per_base\":%.3f,"
+			"\"permutations_per_s\":%.3f,"
+			"\"engine_peak_bytes\":%lu,\"peak_rss_kb\":%ld}\n",
+			source, l, k, n, shuffle_width(), mem.n_vertices,
+			s1 / 1e6, s2 / 1e6, s1 / l, s2 / l,
+			s2 > 0 ? 1e9 / s2 : 0, mem.peak, peak_rss_kb());
+	fflush(stdout);
+}
+
+/* sweep lengths and ks over one source sequence of length l */
+static void sweep(const bench_opts *o, const char *source, const char *s, long l) {
+	char *lengths = o->lengths ? strdup(o->lengths) : NULL, *lp = lengths, *litem;
+	char *ks, *kp, *kitem;
+	long len;
+
+	for (;;) {
+		if (lengths) {
+			if ((litem = next_item(&lp)) == NULL)
+				break;
+			len = parse_length(litem);
+			if (len > l) {
+				fprintf(stderr, "skipping length %ld: %s has only %ld bases\n", len, source, l);
+				continue;
+			}
+		} else
+			len = l;
+
+		ks = strdup(o->ks);
+		kp = ks;
+		while ((kitem = next_item(&kp)) != NULL)
+			run(source, s, len, atoi(kitem), o->n);
+		free(ks);
+
+		if (!lengths)
+			break;
+	}
+	free(lengths);
+}
+
+void benchmark(const bench_opts *o) {
+	char *alphabets, *p, *alphabet, *s;
+	long l;
+
+	srandom(o->seed);
+	set_randfunc((randfunc_t) random);
+
+	if (o->sequence) {
+		sweep(o, "sequence", o->sequence, strlen(o->sequence));
+		return;
+	}
+	if (o->file) {
+		s = read_file(o->file, &l);
+		sweep(o, o->file, s, l);
+		free(s);
+		return;
+	}
+
+	/* synthetic sequences, long enough for the longest length */
+	l = max_length(o->lengths);
+	alphabets = strdup(o->alphabets);
+	p = alphabets;
+	while ((alphabet = next_item(&p)) != NULL) {
+		s = synthesize(alphabet, l);
+		sweep(o, alphabet, s, l);
+		free(s);
+	}
+	free(alphabets);
+}
@@ -0,0 +1,29 @@
+/*
+   bench - benchmark harness of the ushuffle command-line tool.
+
+   Released under the same license as uShuffle (see README).
+ */
+
+/*
+ *	bench.h - shuffle1/shuffle2 benchmark sweeps
+ */
+#ifndef BENCH_H
+#define BENCH_H
+
+typedef struct bench_opts {
+	const char *sequence;	/* -s: benchmark this sequence (and its prefixes) */
+	const char *file;	/* -f: or the sequence read from this file */
+	const char *lengths;	/* -L: comma separated lengths, with k/M/G suffixes */
+	const char *ks;		/* -K: comma separated let sizes */
+	const char *alphabets;	/* -A: comma separated alphabets of synthetic sequences */
+	int n;			/* shuffle2 calls per configuration */
+	unsigned long seed;
+} bench_opts;
+
+/*
+ * runs shuffle1 once and shuffle2 n times for every combination of
+ * source, length and k, and prints one JSON object per line to stdout.
+ */
+void benchmark(const bench_opts *o);
+
+#endif
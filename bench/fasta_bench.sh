@@ -0,0 +1,91 @@
+#!/bin/sh
+#
+# fasta_bench.sh - end-to-end throughput benchmark of fasta_ushuffle.
+#
+# Generates (once, with fasta_synth) a set of single-line FASTA corpora in
+# $CORPUS, runs
+# fasta_ushuffle over each of them for every thread count and option set,
+# and prints one tab-separated line per run: corpus, threads, options,
+# records, input MB, seconds, MB/s and records/s.
+#
+# Environment (all optional):
+#   FASTA_USHUFFLE  binary to benchmark (default ./fasta_ushuffle)
+#   FASTA_SYNTH     corpus generator (default ./fasta_synth)
+#   CORPUS          corpus directory (default bench/corpus)
+#   SCALE           multiplies all record counts (default 1)
+#   THREADS         space separated thread counts (default "1")
+#   OPTIONS         ';' separated fasta_ushuffle option sets (default "-k 2")
+#   REPEAT          runs per configuration, the fastest is reported (default 1)
+#   SEED            seed for corpus generation and shuffling (default 1)
+
+set -e
+
+FASTA_USHUFFLE=${FASTA_USHUFFLE:-./fasta_ushuffle}
+FASTA_SYNTH=${FASTA_SYNTH:-./fasta_synth}
+CORPUS=${CORPUS:-bench/corpus}
+SCALE=${SCALE:-1}
+THREADS=${THREADS:-1}
+OPTIONS=${OPTIONS:--k 2}
+REPEAT=${REPEAT:-1}
+SEED=${SEED:-1}
+
+# gen_fasta FILE FASTA_SYNTH_OPTIONS...
+gen_fasta()
+{
+	file=$1
+	shift
+	[ -s "$file" ] && return
+	echo "generating $file" >&2
+	"$FASTA_SYNTH" -s "$SEED" "$@" > "$file.tmp"
+	mv "$file.tmp" "$file"
+}
+
+# scale COUNT: the record count multiplied by $SCALE, at least 1
+scale()
+{
+	echo "$1 $SCALE" | awk '{ n = int($1 * $2); print (n < 1) ? 1 : n }'
+}
+
+now()
+{
+	date +%s.%N
+}
+
+mkdir -p "$CORPUS"
+gen_fasta "$CORPUS/short_reads.fa" -d "$(scale 200000):fixed:150" -g 0.45
+gen_fasta "$CORPUS/long_reads.fa" -d "$(scale 2000):lognormal:10k:0.4" -g 0.45 -r 0.02
+gen_fasta "$CORPUS/chromosomes.fa" -d "$(scale 2):uniform:20M:30M" -g 0.41 -r 0.05 -a 0.0001
+gen_fasta "$CORPUS/mixed.fa" -i -g 0.41 -r 0.03 \
+	-d "$(scale 1):fixed:20M" -d "$(scale 500):lognormal:10k:0.4" -d "$(scale 100000):fixed:150"
+gen_fasta "$CORPUS/repeats.fa" -d "$(scale 20000):uniform:100:2000" -r 0.6 -u 1:50 -c 2:40
+
+printf "corpus\tthreads\toptions\trecords\tMB\tseconds\tMB/s\trecords/s\n"
+for corpus in short_reads long_reads chromosomes mixed repeats; do
+	file="$CORPUS/$corpus.fa"
+	bytes=$(wc -c < "$file")
+	records=$(grep -c '^>' "$file")
+	for threads in $THREADS; do
+		echo "$OPTIONS" | tr ';' '\n' | while read -r opts; do
+			topts="$opts"
+			[ "$threads" != 1 ] && topts="$opts -t $threads"
+			best=
+			i=0
+			while [ $i -lt "$REPEAT" ]; do
+				start=$(now)
+				# shellcheck disable=SC2086
+				"$FASTA_USHUFFLE" -s "$SEED" $topts < "$file" > /dev/null 2>&1
+				end=$(now)
+				secs=$(echo "$start $end" | awk '{ printf("%.3f", $2 - $1) }')
+				if [ -z "$best" ] || [ "$(echo "$secs $best" | awk '{ print ($1 < $2) }')" = 1 ]; then
+					best=$secs
+				fi
+				i=$((i + 1))
+			done
+			echo "$corpus $threads $bytes $records $best" | awk -v opts="$opts" '{
+				mb = $3 / 1e6;
+				printf("%s\t%s\t%s\t%d\t%.1f\t%s\t%.2f\t%.0f\n", $1, $2, opts, $4, mb, $5,
+						$5 > 0 ? mb / $5 : 0, $5 > 0 ? $4 / $5 : 0);
+			}'
+		done
+	done
+done
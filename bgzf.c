@@ -0,0 +1,153 @@
+/*
+   bgzf - BGZF output of fasta_ushuffle.
+
+   Released under the same license as uShuffle (see README).
+ */
+
+/*
+ *	bgzf.c - BGZF compression and .gzi indexes
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <zlib.h>
+#include "bgzf.h"
+
+#define BGZF_HEADER	18
+#define BGZF_FOOTER	8
+
+const unsigned char bgzf_eof[28] = {
+	0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 0xff, 6, 0, 'B', 'C', 2, 0, 0x1b, 0,
+	3, 0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+static __thread z_stream stream;
+static __thread int stream_level = -2;	/* not initialized */
+
+static void put16(unsigned char *p, unsigned v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static void put32(unsigned char *p, unsigned long v)
+{
+	put16(p, v);
+	put16(p + 2, v >> 16);
+}
+
+/* compresses one block of at most BGZF_BLOCK_DATA bytes to out, returns its size */
+static size_t compress_block(unsigned char *out, size_t room, const unsigned char *data, size_t len, int level)
+{
+	static const unsigned char header[BGZF_HEADER] = {
+		0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 0xff, 6, 0, 'B', 'C', 2, 0, 0, 0
+	};
+	size_t size;
+
+	if (stream_level != level) {
+		if (stream_level != -2)
+			deflateEnd(&stream);
+		memset(&stream, 0, sizeof(stream));
+		if (deflateInit2(&stream, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+			errx(1,"deflateInit2 failed");
+		stream_level = level;
+	} else if (deflateReset(&stream) != Z_OK)
+		errx(1,"deflateReset failed");
+
+	stream.next_in = (unsigned char *) data;
+	stream.avail_in = len;
+	stream.next_out = out + BGZF_HEADER;
+	stream.avail_out = room - BGZF_HEADER - BGZF_FOOTER;
+	if (deflate(&stream, Z_FINISH) != Z_STREAM_END)
+		errx(1,"deflate failed");
+	size = BGZF_HEADER + stream.total_out + BGZF_FOOTER;
+
+	memcpy(out, header, BGZF_HEADER);
+	put16(out + 16, size - 1);
+	put32(out + size - 8, crc32(0, data, len));
+	put32(out + size - 4, len);
+	return size;
+}
+
+void bgzf_compress(bgzf_buffer *b, const void *data, size_t len, int level)
+{
+	const unsigned char *p = data;
+	size_t n, room;
+
+	for (; len > 0; p += n, len -= n) {
+		n = len < BGZF_BLOCK_DATA ? len : BGZF_BLOCK_DATA;
+		room = BGZF_HEADER + deflateBound(NULL, n) + BGZF_FOOTER;
+		if (b->size + room > b->alloc) {
+			b->alloc = b->size + room > 2 * b->alloc ? b->size + room : 2 * b->alloc;
+			if ((b->data = realloc(b->data, b->alloc)) == NULL)
+				err(1,"realloc failed");
+		}
+		if (b->n_blocks == b->blocks_alloc) {
+			b->blocks_alloc = b->blocks_alloc ? 2 * b->blocks_alloc : 16;
+			if ((b->block_sizes = realloc(b->block_sizes, b->blocks_alloc * sizeof(unsigned))) == NULL
+			    || (b->data_sizes = realloc(b->data_sizes, b->blocks_alloc * sizeof(unsigned))) == NULL)
+				err(1,"realloc failed");
+		}
+		b->block_sizes[b->n_blocks] = compress_block(b->data + b->size, room, p, n, level);
+		b->data_sizes[b->n_blocks] = n;
+		b->size += b->block_sizes[b->n_blocks++];
+	}
+}
+
+void bgzf_buffer_free(bgzf_buffer *b)
+{
+	free(b->data);
+	free(b->block_sizes);
+	free(b->data_sizes);
+	memset(b, 0, sizeof(*b));
+}
+
+/* like htslib, an entry for the start of every block after the first */
+void bgzf_index_add(bgzf_index *index, const bgzf_buffer *b)
+{
+	int i;
+
+	for (i = 0; i < b->n_blocks; i++) {
+		if (index->n + 2 > index->alloc) {
+			index->alloc = index->alloc ? 2 * index->alloc : 1024;
+			if ((index->offsets = realloc(index->offsets, index->alloc * sizeof(unsigned long long))) == NULL)
+				err(1,"realloc failed");
+		}
+		index->compressed += b->block_sizes[i];
+		index->uncompressed += b->data_sizes[i];
+		index->offsets[index->n++] = index->compressed;
+		index->offsets[index->n++] = index->uncompressed;
+	}
+}
+
+static int write64(FILE *f, unsigned long long v)
+{
+	unsigned char p[8];
+
+	put32(p, v);
+	put32(p + 4, v >> 32);
+	return fwrite(p, 8, 1, f) == 1;
+}
+
+int bgzf_index_write(const bgzf_index *index, const char *path)
+{
+	FILE *f;
+	size_t i;
+	int ok;
+
+	if ((f = fopen(path, "wb")) == NULL)
+		return 0;
+	ok = write64(f, index->n / 2);
+	for (i = 0; i < index->n && ok; i++)
+		ok = write64(f, index->offsets[i]);
+	if (fclose(f) != 0)
+		ok = 0;
+	return ok;
+}
+
+void bgzf_index_free(bgzf_index *index)
+{
+	free(index->offsets);
+	memset(index, 0, sizeof(*index));
+}
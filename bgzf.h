@@ -0,0 +1,60 @@
+/*
+   bgzf - BGZF output of fasta_ushuffle.
+
+   Released under the same license as uShuffle (see README).
+ */
+
+/*
+ *	bgzf.h - BGZF compression and .gzi indexes
+ *
+ *	BGZF is gzip made of independent members (blocks) of at most 64 KB
+ *	of data, each recording its own compressed size, so a file can be
+ *	compressed in pieces by several threads and the pieces concatenated,
+ *	and readers can seek to the start of any block. The .gzi index of
+ *	htslib lists the compressed and uncompressed offsets of the blocks.
+ */
+#ifndef BGZF_H
+#define BGZF_H
+
+#include <stddef.h>
+
+/* data bytes per block, as bgzip */
+#define BGZF_BLOCK_DATA 65280
+
+/* zlib's default compression level (6) */
+#define BGZF_DEFAULT_LEVEL (-1)
+
+/* the empty block that ends a BGZF file */
+extern const unsigned char bgzf_eof[28];
+
+typedef struct bgzf_buffer {
+	unsigned char *data;	/* the blocks */
+	size_t size, alloc;
+	unsigned *block_sizes;	/* compressed size of each block */
+	unsigned *data_sizes;	/* and of its data */
+	int n_blocks, blocks_alloc;
+} bgzf_buffer;
+
+/*
+   Appends len bytes of data to b, compressed into blocks at zlib level.
+   Uses a compressor of the calling thread.
+ */
+void bgzf_compress(bgzf_buffer *b, const void *data, size_t len, int level);
+
+void bgzf_buffer_free(bgzf_buffer *b);
+
+typedef struct bgzf_index {
+	unsigned long long *offsets;	/* compressed, uncompressed, ... */
+	size_t n, alloc;
+	unsigned long long compressed, uncompressed;	/* end of the file so far */
+} bgzf_index;
+
+/* adds the blocks of b, the next ones in the file */
+void bgzf_index_add(bgzf_index *index, const bgzf_buffer *b);
+
+/* writes index to path as .gzi; 0 on error, with errno set */
+int bgzf_index_write(const bgzf_index *index, const char *path);
+
+void bgzf_index_free(bgzf_index *index);
+
+#endif
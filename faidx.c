@@ -0,0 +1,192 @@
+/*
+   faidx - indexed FASTA regions of fasta_ushuffle.
+
+   Released under the same license as uShuffle (see README).
+ */
+
+/*
+ *	faidx.c - .fai indexes and BED regions
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+#include "faidx.h"
+
+struct faidx {
+	faidx_entry *entries;	/* sorted by name */
+	long n;
+};
+
+static int compare_names(const void *a, const void *b)
+{
+	return strcmp(((const faidx_entry *) a)->name, ((const faidx_entry *) b)->name);
+}
+
+/* parses a non-negative number ending at a tab or the end of the line */
+static int parse_number(char **p, long *v)
+{
+	char *end;
+
+	*v = strtol(*p, &end, 10);
+	if (end == *p || *v < 0 || (*end != '\t' && *end != '\n' && *end != 0))
+		return 0;
+	*p = end + (*end == '\t');
+	return 1;
+}
+
+faidx *faidx_load(const char *path)
+{
+	FILE *f;
+	faidx *fai;
+	faidx_entry *e;
+	char *line = NULL, *p, *tab;
+	size_t line_alloc = 0;
+	long alloc = 0, line_no = 0, offset;
+
+	if ((f = fopen(path, "r")) == NULL)
+		return NULL;
+	if ((fai = calloc(1, sizeof(faidx))) == NULL)
+		err(1,"calloc failed");
+	while (getline(&line, &line_alloc, f) > 0) {
+		line_no++;
+		if (fai->n == alloc) {
+			alloc = alloc ? 2 * alloc : 64;
+			if ((fai->entries = realloc(fai->entries, alloc * sizeof(faidx_entry))) == NULL)
+				err(1,"realloc failed");
+		}
+		e = &fai->entries[fai->n];
+		if ((tab = strchr(line, '\t')) == NULL)
+			errx(1,"%s:%ld: invalid .fai line", path, line_no);
+		*tab = 0;
+		p = tab + 1;
+		if (!parse_number(&p, &e->length) || !parse_number(&p, &offset)
+		    || !parse_number(&p, &e->line_bases) || !parse_number(&p, &e->line_bytes)
+		    || e->line_bases == 0 || e->line_bytes < e->line_bases)
+			errx(1,"%s:%ld: invalid .fai line", path, line_no);
+		e->offset = offset;
+		if ((e->name = strdup(line)) == NULL)
+			err(1,"strdup failed");
+		fai->n++;
+	}
+	if (ferror(f))
+		err(1,"can't read '%s'", path);
+	free(line);
+	fclose(f);
+	qsort(fai->entries, fai->n, sizeof(faidx_entry), compare_names);
+	return fai;
+}
+
+const faidx_entry *faidx_find(const faidx *fai, const char *name)
+{
+	faidx_entry key;
+
+	key.name = (char *) name;
+	return bsearch(&key, fai->entries, fai->n, sizeof(faidx_entry), compare_names);
+}
+
+/* file offset of base pos of e */
+static off_t base_offset(const faidx_entry *e, long pos)
+{
+	return e->offset + (off_t) (pos / e->line_bases) * e->line_bytes + pos % e->line_bases;
+}
+
+size_t faidx_span(const faidx_entry *e, long start, long end)
+{
+	return end > start ? base_offset(e, end - 1) + 1 - base_offset(e, start) : 0;
+}
+
+long faidx_fetch(int fd, const faidx_entry *e, long start, long end, char *buf)
+{
+	size_t span = faidx_span(e, start, end), done = 0;
+	ssize_t n;
+	char *p, *q;
+
+	while (done < span) {
+		if ((n = pread(fd, buf + done, span - done, base_offset(e, start) + done)) < 0)
+			return -1;
+		if (n == 0)
+			break;
+		done += n;
+	}
+	for (p = q = buf; p < buf + done; p++)
+		if (*p != '\n' && *p != '\r')
+			*q++ = *p;
+	*q = 0;
+	return q - buf;
+}
+
+void faidx_free(faidx *fai)
+{
+	long i;
+
+	for (i = 0; i < fai->n; i++)
+		free(fai->entries[i].name);
+	free(fai->entries);
+	free(fai);
+}
+
+void faidx_add(faidx_buffer *buf, const char *name, size_t len, long length, off_t offset,
+	       long line_bases, long line_bytes)
+{
+	faidx_entry *e;
+
+	if (buf->n == buf->alloc) {
+		buf->alloc = buf->alloc ? 2 * buf->alloc : 16;
+		if ((buf->entries = realloc(buf->entries, buf->alloc * sizeof(faidx_entry))) == NULL)
+			err(1,"realloc failed");
+	}
+	e = &buf->entries[buf->n++];
+	if ((e->name = strndup(name, len)) == NULL)
+		err(1,"strndup failed");
+	e->length = length;
+	e->offset = offset;
+	e->line_bases = line_bases;
+	e->line_bytes = line_bytes;
+}
+
+int faidx_write(FILE *f, const faidx_buffer *buf, off_t base)
+{
+	const faidx_entry *e;
+	long i;
+
+	for (i = 0; i < buf->n; i++) {
+		e = &buf->entries[i];
+		if (fprintf(f, "%s\t%ld\t%lld\t%ld\t%ld\n", e->name, e->length,
+			    (long long) (base + e->offset), e->line_bases, e->line_bytes) < 0)
+			return 0;
+	}
+	return 1;
+}
+
+void faidx_buffer_free(faidx_buffer *buf)
+{
+	long i;
+
+	for (i = 0; i < buf->n; i++)
+		free(buf->entries[i].name);
+	free(buf->entries);
+	buf->entries = NULL;
+	buf->n = buf->alloc = 0;
+}
+
+int bed_parse(char *line, char **name, long *start, long *end)
+{
+	char *p = line;
+
+	while (*p == ' ' || *p == '\t')
+		p++;
+	if (*p == 0 || *p == '\n' || *p == '\r' || *p == '#'
+	    || strncmp(p, "track", 5) == 0 || strncmp(p, "browser", 7) == 0)
+		return 0;
+	*name = p;
+	p += strcspn(p, " \t\r\n");
+	if (*p != ' ' && *p != '\t')
+		return -1;
+	*p++ = 0;
+	if (sscanf(p, "%ld %ld", start, end) != 2 || *start < 0 || *end <= *start)
+		return -1;
+	return 1;
+}
@@ -0,0 +1,73 @@
+/*
+   faidx - indexed FASTA regions of fasta_ushuffle.
+
+   Released under the same license as uShuffle (see README).
+ */
+
+/*
+ *	faidx.h - .fai indexes and BED regions
+ *
+ *	A .fai index (samtools faidx) gives for every sequence of a FASTA
+ *	file its length, the offset of its first base and its line width,
+ *	so the bases of any region can be read with a single pread(), in
+ *	wrapped files too. BED lines give regions as a sequence name and
+ *	0-based, end-exclusive coordinates. The index of an output can be
+ *	collected while it is written, in pieces of known relative offsets.
+ */
+#ifndef FAIDX_H
+#define FAIDX_H
+
+#include <stdio.h>
+#include <sys/types.h>
+
+typedef struct faidx_entry {
+	char *name;
+	long length;		/* bases */
+	off_t offset;		/* of the first base */
+	long line_bases;	/* bases per line */
+	long line_bytes;	/* and with the line end */
+} faidx_entry;
+
+typedef struct faidx faidx;
+
+/* reads the index at path; exits if it is not valid, NULL if it can't be opened */
+faidx *faidx_load(const char *path);
+
+/* the entry of a sequence, NULL if it is not in the index */
+const faidx_entry *faidx_find(const faidx *fai, const char *name);
+
+/* bytes of the file holding bases start to end of e, line ends included */
+size_t faidx_span(const faidx_entry *e, long start, long end);
+
+/*
+   Reads bases start to end of e from fd into buf, which holds at least
+   faidx_span() + 1 bytes, dropping the line ends and adding a
+   terminator. Returns the number of bases, -1 on read errors.
+ */
+long faidx_fetch(int fd, const faidx_entry *e, long start, long end, char *buf);
+
+void faidx_free(faidx *fai);
+
+/* entries of a piece of an output, in order */
+typedef struct faidx_buffer {
+	faidx_entry *entries;
+	long n, alloc;
+} faidx_buffer;
+
+/* adds an entry; name is the len bytes at name, the offset relative to the piece */
+void faidx_add(faidx_buffer *buf, const char *name, size_t len, long length, off_t offset,
+	       long line_bases, long line_bytes);
+
+/* writes the entries of buf as .fai lines, for the piece at base; 0 on error */
+int faidx_write(FILE *f, const faidx_buffer *buf, off_t base);
+
+void faidx_buffer_free(faidx_buffer *buf);
+
+/*
+   Parses a BED line in place: name points into line. Returns 1 for a
+   region, 0 for a line to skip (empty, comment, track or browser line)
+   and -1 if it is not valid.
+ */
+int bed_parse(char *line, char **name, long *start, long *end);
+
+#endif
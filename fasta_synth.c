@@ -0,0 +1,327 @@
+/*
+   fasta_synth - writes synthetic FASTA files for performance testing.
+
+   Released under the same license as uShuffle (see README).
+ */
+
+/*
+ *	fasta_synth.c - synthetic FASTA generator
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <err.h>
+#include <math.h>
+#include <stdbool.h>
+#include "units.h"
+
+#define VERSION "0.2"
+
+#define HELPTEXT \
+"fasta_synth: writes synthetic FASTA files for benchmarking fasta_ushuffle.\n" \
+"\n" \
+"VERSION " VERSION "\n" \
+"\n" \
+"Usage: fasta_synth [-h] [-d SPEC]... [-g GC] [-r FRACTION] [-u MIN:MAX] [-c MIN:MAX]\n" \
+"                   [-a RATE] [-w WIDTH] [-i] [-s N] > OUTPUT.FA\n" \
+"\n" \
+" -h            This help screen\n" \
+" -d SPEC       A group of records, COUNT:DISTRIBUTION:PARAMETERS, one of\n" \
+"                 COUNT:fixed:LENGTH\n" \
+"                 COUNT:uniform:MIN:MAX\n" \
+"                 COUNT:lognormal:MEDIAN:SIGMA\n" \
+"               May be repeated (default 1000:fixed:150). Lengths accept\n" \
+"               k/M/G suffixes.\n" \
+" -i            Interleave the groups randomly instead of writing them in order.\n" \
+" -g GC         GC content of the random bases (default 0.5).\n" \
+" -r FRACTION   Approximate fraction of bases in tandem repeats (default 0).\n" \
+" -u MIN:MAX    Repeat unit length range (default 1:6, microsatellites).\n" \
+" -c MIN:MAX    Copies of the unit per repeat (default 5:50).\n" \
+" -a RATE       Per-base rate of IUPAC ambiguity codes (default 0).\n" \
+" -w WIDTH      Wrap sequence lines at WIDTH (default 0: single line, as\n" \
+"               required by fasta_ushuffle).\n" \
+" -s N          Seed (default 1). The same options and seed always give the\n" \
+"               same output, on any platform.\n" \
+"\n" \
+"Example: one chromosome plus short and long reads, 40%% GC, 5%% repeats:\n" \
+"  fasta_synth -d 1:fixed:50M -d 100000:fixed:150 -d 500:uniform:5k:15k \\\n" \
+"              -i -g 0.4 -r 0.05 > mixed.fa\n" \
+"\n"
+
+void showhelp()
+{
+	fprintf(stderr, HELPTEXT );
+	exit(0);
+}
+
+/*
+   Portable pseudo-random numbers (splitmix64), so that corpora are
+   reproducible independently of the libc random().
+ */
+static unsigned long long rng_state;
+
+unsigned long long rng_next()
+{
+	unsigned long long z = (rng_state += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+//uniform in [0,1)
+double rng_double()
+{
+	return (rng_next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+//uniform in [min,max]
+long rng_range(long min, long max)
+{
+	return min + (long)(rng_next() % (unsigned long long)(max - min + 1));
+}
+
+double rng_normal()
+{
+	double u1 = rng_double(), u2 = rng_double();
+	return sqrt(-2.0 * log(1.0 - u1)) * cos(2.0 * M_PI * u2);
+}
+
+enum { DIST_FIXED, DIST_UNIFORM, DIST_LOGNORMAL };
+
+typedef struct record_group {
+	long count;
+	long remaining;
+	int distribution;
+	double a, b;
+} record_group;
+
+/* a length up to the end of s or a ':' */
+static long parse_length(const char *s, const char *what)
+{
+	const char *end;
+	long v = units_length(s, &end);
+
+	if (v<0 || (*end!=0 && *end!=':'))
+		errx(1,"invalid %s value (%s)", what, s);
+	return v;
+}
+
+void parse_range(const char *s, long *min, long *max, const char *what)
+{
+	const char *colon = strchr(s, ':');
+
+	if (colon==NULL)
+		errx(1,"invalid %s value (%s). Expecting MIN:MAX.", what, s);
+	*min = parse_length(s, what);
+	*max = parse_length(colon+1, what);
+	if (*min<1 || *max<*min)
+		errx(1,"invalid %s value (%s). Expecting 1 <= MIN <= MAX.", what, s);
+}
+
+void parse_group(const char *spec, record_group *g)
+{
+	char *copy = strdup(spec);
+	char *count = strtok(copy, ":");
+	char *dist = strtok(NULL, ":");
+	char *p1 = strtok(NULL, ":");
+	char *p2 = strtok(NULL, ":");
+
+	if (count==NULL || dist==NULL || p1==NULL)
+		errx(1,"invalid -d value (%s)", spec);
+	g->count = g->remaining = parse_length(count, "-d count");
+	if (strcmp(dist,"fixed")==0) {
+		g->distribution = DIST_FIXED;
+		g->a = parse_length(p1, "-d length");
+	} else if (strcmp(dist,"uniform")==0 && p2!=NULL) {
+		g->distribution = DIST_UNIFORM;
+		g->a = parse_length(p1, "-d length");
+		g->b = parse_length(p2, "-d length");
+		if (g->b < g->a)
+			errx(1,"invalid -d value (%s): MAX < MIN", spec);
+	} else if (strcmp(dist,"lognormal")==0 && p2!=NULL) {
+		g->distribution = DIST_LOGNORMAL;
+		g->a = parse_length(p1, "-d median");
+		g->b = atof(p2);
+	} else
+		errx(1,"invalid -d value (%s)", spec);
+	free(copy);
+}
+
+long group_length(const record_group *g)
+{
+	long l;
+
+	switch (g->distribution) {
+	case DIST_UNIFORM:
+		l = rng_range((long)g->a, (long)g->b);
+		break;
+	case DIST_LOGNORMAL:
+		l = (long)(g->a * exp(g->b * rng_normal()));
+		break;
+	default:
+		l = (long)g->a;
+	}
+	return l < 1 ? 1 : l;
+}
+
+//Generator settings
+double gc_content = 0.5;
+double repeat_fraction = 0.0;
+long unit_min = 1, unit_max = 6;
+long copies_min = 5, copies_max = 50;
+double ambiguity_rate = 0.0;
+long wrap_width = 0;
+
+static const char iupac[] = "NNNNNRYSWKMBDHV";
+
+char random_base()
+{
+	double r = rng_double();
+
+	if (r < gc_content / 2)
+		return 'G';
+	if (r < gc_content)
+		return 'C';
+	if (r < gc_content + (1.0 - gc_content) / 2)
+		return 'A';
+	return 'T';
+}
+
+/*
+   Fills s with l bases: random bases at the requested GC content, tandem
+   repeats of random units covering about repeat_fraction of the bases,
+   and IUPAC codes sprinkled at ambiguity_rate.
+ */
+void make_sequence(char *s, long l)
+{
+	double mean_repeat = ((unit_min + unit_max) / 2.0) * ((copies_min + copies_max) / 2.0);
+	double repeat_start = repeat_fraction / (mean_repeat * (1.0 - repeat_fraction) + repeat_fraction);
+	char unit[4096];
+	long i = 0, j, unit_len, run;
+
+	while (i < l) {
+		if (repeat_fraction > 0 && rng_double() < repeat_start) {
+			unit_len = rng_range(unit_min, unit_max);
+			for (j = 0; j < unit_len; j++)
+				unit[j] = random_base();
+			run = unit_len * rng_range(copies_min, copies_max);
+			for (j = 0; j < run && i < l; j++)
+				s[i++] = unit[j % unit_len];
+		} else
+			s[i++] = random_base();
+	}
+	if (ambiguity_rate > 0)
+		for (i = 0; i < l; i++)
+			if (rng_double() < ambiguity_rate)
+				s[i] = iupac[rng_next() % (sizeof(iupac) - 1)];
+}
+
+void write_record(long id, const char *s, long l)
+{
+	long i;
+
+	printf(">synth%ld len=%ld\n", id, l);
+	if (wrap_width == 0) {
+		fwrite(s, 1, l, stdout);
+		putchar('\n');
+		return;
+	}
+	for (i = 0; i < l; i += wrap_width) {
+		fwrite(s + i, 1, (l - i < wrap_width) ? l - i : wrap_width, stdout);
+		putchar('\n');
+	}
+}
+
+int main(int argc, char **argv)
+{
+	record_group *groups = NULL;
+	int n_groups = 0;
+	bool interleave = false;
+	unsigned long long seed = 1;
+	long total = 0, id, l, alloc = 0, pick;
+	char *s = NULL;
+	int c, g;
+
+	while ( (c=getopt(argc, argv, "hd:ig:r:u:c:a:w:s:"))!=-1) {
+		switch (c)
+		{
+		case 'd':
+			if ((groups = realloc(groups, (n_groups+1) * sizeof(record_group)))==NULL)
+				err(1,"realloc failed");
+			parse_group(optarg, &groups[n_groups++]);
+			break;
+		case 'i':
+			interleave = true;
+			break;
+		case 'g':
+			gc_content = atof(optarg);
+			if (gc_content<0 || gc_content>1)
+				errx(1,"invalid -g value (%s). Must be between 0 and 1.", optarg);
+			break;
+		case 'r':
+			repeat_fraction = atof(optarg);
+			if (repeat_fraction<0 || repeat_fraction>=1)
+				errx(1,"invalid -r value (%s). Must be between 0 and 1.", optarg);
+			break;
+		case 'u':
+			parse_range(optarg, &unit_min, &unit_max, "-u");
+			if (unit_max > 4096)
+				errx(1,"invalid -u value (%s). Units are at most 4096 bases.", optarg);
+			break;
+		case 'c':
+			parse_range(optarg, &copies_min, &copies_max, "-c");
+			break;
+		case 'a':
+			ambiguity_rate = atof(optarg);
+			if (ambiguity_rate<0 || ambiguity_rate>1)
+				errx(1,"invalid -a value (%s). Must be between 0 and 1.", optarg);
+			break;
+		case 'w':
+			wrap_width = atol(optarg);
+			if (wrap_width<0)
+				errx(1,"invalid -w value (%s).", optarg);
+			break;
+		case 's':
+			seed = strtoull(optarg, NULL, 10);
+			break;
+		default:
+		case 'h':
+			showhelp();
+		}
+	}
+	if (n_groups==0) {
+		if ((groups = malloc(sizeof(record_group)))==NULL)
+			err(1,"malloc failed");
+		parse_group("1000:fixed:150", &groups[n_groups++]);
+	}
+	rng_state = seed;
+
+	for (g = 0; g < n_groups; g++)
+		total += groups[g].count;
+
+	for (id = 1; id <= total; id++) {
+		//pick the group of this record
+		if (interleave) {
+			pick = rng_next() % (unsigned long long)(total - id + 1);
+			for (g = 0; pick >= groups[g].remaining; g++)
+				pick -= groups[g].remaining;
+		} else
+			for (g = 0; groups[g].remaining == 0; g++)
+				;
+		groups[g].remaining--;
+
+		l = group_length(&groups[g]);
+		if (l > alloc) {
+			alloc = l;
+			if ((s = realloc(s, alloc))==NULL)
+				err(1,"realloc(%ld) failed", alloc);
+		}
+		make_sequence(s, l);
+		write_record(id, s, l);
+	}
+
+	free(s);
+	free(groups);
+	return 0;
+}
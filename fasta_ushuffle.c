@@ -36,19 +36,41 @@
 /*
  *	fasta_ushuffle.c - command-line interface of uShuffle
  */
+#define _GNU_SOURCE	//fallocate()
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <getopt.h>
 #include <err.h>
-#include <sys/resource.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include <sys/time.h>
 #include <stdbool.h>
+#include <math.h>
+#include <pthread.h>
+#include <setjmp.h>
 #include "ushuffle.h"
+#include "packdna.h"
+#include "umem.h"
+#include "stats.h"
+#include "progress.h"
+#include "probes.h"
+#include "trace.h"
+#include "workq.h"
+#include "ring.h"
+#include "uring.h"
+#include "gzin.h"
+#include "bgzf.h"
+#include "twobit.h"
+#include "faidx.h"
+#include "units.h"
 
-//Hard-coded limits, seems resonable for next-gen (short) reads
-#define	MAX_ID_SIZE 32678
-#define MAX_SEQUENCE_SIZE (1000000)
+//Largest shuffling graph whose number of distinct shuffles --failures counts
+#define MAX_COUNT_VERTICES 1024
 
 #define VERSION "0.2"
 
@@ -59,7 +81,8 @@
 "\n" \
 "\nCopyright (C) 2010 A. gordon (gordon@cshl.edu).\n" \
 "\nUses the uShuffle library code by: Minghui Jiang, James Anderson, Joel Gillespie, and Martin Mayne.\n" "\n" \
-"Usage: fasta_ushuffle [-r N] [-h] [-o] [-n N] [-k N] [-s N] < INPUT.FA > OUTPUT.FA\n" \
+"Usage: fasta_ushuffle [-r N] [-h] [-o] [-p] [-n N] [-k N] [-s N] [-t N] [-z] [OPTIONS] < INPUT.FA > OUTPUT.FA\n" \
+"       fasta_ushuffle [OPTIONS] --output=TEMPLATE INPUT.FA...\n" \
 "\n" \
 " -h		This help screen\n" \
 " -o            Print original (unshuffled) in output file.\n" \
@@ -67,7 +90,81 @@
 " -s N		specifies the seed for random number generator.\n" \
 " -n N          For each input sequence, print N permutations (default is 1).\n" \
 "               Use this only for debugging.\n" \
-" -r N          Retry N times to find a new shuffle (Default is 10). After N retries, a warning is printed, and a non-shuffled sequence will be written.\n" \
+" -r N          Retry N times to find a new shuffle (Default is 10). After N retries, a non-shuffled sequence will be written,\n" \
+"               and a warning with the number of such records is printed at the end.\n" \
+" -p            Shuffle with the packed 2-bit engine (less memory on long DNA).\n" \
+"               N/IUPAC runs and lower-case (soft-masked) stretches stay in place,\n" \
+"               and the ACGT stretches between N/IUPAC runs are shuffled separately.\n" \
+" -t N          Shuffle in N threads. Output order is kept. Each permutation then uses\n" \
+"               its own random stream, derived from the seed and the record and\n" \
+"               permutation numbers: the output is the same for any N (but not the\n" \
+"               same as without -t). With -n, the permutations of long records are\n" \
+"               spread over the threads.\n" \
+" -z, --bgzf    Compress the output with BGZF (bgzip's blocked gzip, readable by gzip\n" \
+"               and by indexed tools such as samtools faidx). The blocks are compressed\n" \
+"               by the shuffling threads, in parallel with -t.\n" \
+" --gzi=FILE    With -z, also write the .gzi index of the blocks to FILE.\n" \
+" --wrap=N      Write the sequences in lines of N bases.\n" \
+" --index=FILE  Also write the samtools faidx index (.fai) of the output to FILE, as it\n" \
+"               is written. With -z, it goes with the .gzi of --gzi. A sequence is indexed\n" \
+"               under the first word of its ID and the suffix of -o and -n (-unshuffled,\n" \
+"               -permN), so that the copies of a record get different names.\n" \
+" --format=FMT  Output format: 'fasta' (default) or 'packed', records of 2-bit packed\n" \
+"               bases with their N runs and soft-masked intervals (see packdna.h),\n" \
+"               written straight from the packed engine (implies -p).\n" \
+" --max-memory=SIZE\n" \
+"               Keep at most SIZE bytes (suffixes K, M, G, T) of input blocks and shuffling\n" \
+"               buffers in RAM. Larger buffers are placed in memory-mapped temporary files\n" \
+"               and paged by the kernel. This only saves a run from running out of memory:\n" \
+"               shuffling sorts and walks the graph in random order, so a graph much larger\n" \
+"               than RAM makes the disk thrash. The output is not limited:\n" \
+"               it is held in RAM until written, except with --output and without -z, where\n" \
+"               long records go straight to the file.\n" \
+" --tmpdir=DIR  Directory for the temporary files (default: $TMPDIR or /tmp).\n" \
+"               Buffers also spill there if RAM runs out.\n" \
+" --hugepages[=MODE]\n" \
+"               Back large shuffling buffers with huge pages. MODE is 'thp' (default,\n" \
+"               transparent huge pages), 'hugetlb' (explicit huge pages, falling back\n" \
+"               to thp) or 'off'.\n" \
+" --stats=FILE  Write a JSON summary to FILE at exit: records, bases, time per phase\n" \
+"               (parse, shuffle1, shuffle2, compare, output, compress), a histogram of retries,\n" \
+"               failed shuffles, peak RSS, engine memory, and p50/p99/p99.9/max latency\n" \
+"               of shuffle1, shuffle2 and whole records by record length class.\n" \
+" --progress=N  Print a progress line to STDERR every N seconds. A progress line is\n" \
+"               also printed whenever the process receives SIGUSR1.\n" \
+" --failures=FILE\n" \
+"               List the records for which no new shuffle was found in FILE, as TSV:\n" \
+"               id, length, retries, reason and the number of distinct shuffles of\n" \
+"               the sequence (NA when too large to count), after the input file when\n" \
+"               there are several.\n" \
+" --trace=FILE  Write a timeline of the read, shuffle1, shuffle2 and write spans of\n" \
+"               every thread to FILE in Chrome trace JSON, for Perfetto or\n" \
+"               chrome://tracing. At most 1M spans are kept per thread.\n" \
+" --output=FILE Write the output to FILE instead of STDOUT. FILE is preallocated, and\n" \
+"               every shuffling thread writes its records straight to their place in\n" \
+"               it (the offset of each record is known once it is read), instead of\n" \
+"               passing them through a single writer thread.\n" \
+" --io-uring    Read the input and write the output with io_uring when they are\n" \
+"               regular files: several large reads are kept in flight, and writes\n" \
+"               are submitted in batches. Where io_uring is not available, the\n" \
+"               input and output are read and written as usual.\n" \
+"\n" \
+"The input may be compressed with gzip or bgzip: this is recognized from its first bytes.\n" \
+"BGZF blocks are decompressed in parallel, in as many threads as -t (or one).\n" \
+"The input may also be a UCSC .2bit file: its sequences are read in place (mapped in memory)\n" \
+"and shuffled with the packed engine (as with -p), keeping their N blocks and soft-masking.\n" \
+"\n" \
+"Several input files are shuffled in one run, each to its own output: --output (and --gzi\n" \
+"and --index) is then either given once per input, or once with {name}, replaced by the\n" \
+"name of each input without directory and extension (--output={name}.shuf.fa). The\n" \
+"inputs are read one after the other, but their records are shuffled together by the\n" \
+"threads of -t. Each output is the same as with its input alone.\n" \
+"\n" \
+" --regions=BED Shuffle only the regions listed in BED (0-based, end excluded), each as\n" \
+"               a record named >NAME:START-END (1-based, as samtools faidx). The input\n" \
+"               must be a FASTA file indexed by samtools faidx, which may be wrapped:\n" \
+"               the regions are read straight from their place in it.\n" \
+" --fai=FILE    The index of the input (default: the input file name plus .fai).\n" \
 "\n" \
 "Nucleotide sequences in the input FASTA file must be in a single line.\n" \
 "This is a valid input file:\n" \
@@ -85,6 +182,10 @@
 "  AACCATGAAG\n" \
 "\n" \
 "Use fasta_formatter (from the FASTX-Toolkit) to re-format a multiline fasta file.\n" \
+"\n" \
+"When a record is not valid or the input can't be read, the records before it are\n" \
+"still shuffled and written, then fasta_ushuffle exits with status 1 without reading\n" \
+"the rest of the input (or the inputs that follow).\n" \
 "\n"
 
 void showhelp()
@@ -93,6 +194,45 @@ void showhelp()
 	exit(0);
 }
 
+//Long options without a short equivalent
+enum {
+	OPT_MAX_MEMORY = 256,
+	OPT_TMPDIR,
+	OPT_HUGEPAGES,
+	OPT_STATS,
+	OPT_PROGRESS,
+	OPT_TRACE,
+	OPT_FAILURES,
+	OPT_OUTPUT,
+	OPT_IO_URING,
+	OPT_GZI,
+	OPT_FORMAT,
+	OPT_REGIONS,
+	OPT_FAI,
+	OPT_INDEX,
+	OPT_WRAP
+};
+
+static const struct option long_options[] = {
+	{ "max-memory",	required_argument, NULL, OPT_MAX_MEMORY },
+	{ "tmpdir",	required_argument, NULL, OPT_TMPDIR },
+	{ "hugepages",	optional_argument, NULL, OPT_HUGEPAGES },
+	{ "stats",	required_argument, NULL, OPT_STATS },
+	{ "progress",	required_argument, NULL, OPT_PROGRESS },
+	{ "trace",	required_argument, NULL, OPT_TRACE },
+	{ "failures",	required_argument, NULL, OPT_FAILURES },
+	{ "output",	required_argument, NULL, OPT_OUTPUT },
+	{ "io-uring",	no_argument,	   NULL, OPT_IO_URING },
+	{ "bgzf",	no_argument,	   NULL, 'z' },
+	{ "gzi",	required_argument, NULL, OPT_GZI },
+	{ "format",	required_argument, NULL, OPT_FORMAT },
+	{ "regions",	required_argument, NULL, OPT_REGIONS },
+	{ "fai",	required_argument, NULL, OPT_FAI },
+	{ "index",	required_argument, NULL, OPT_INDEX },
+	{ "wrap",	required_argument, NULL, OPT_WRAP },
+	{ NULL, 0, NULL, 0 }
+};
+
 bool is_valid_nucleotide_string(const char *s)
 {
 	if (s==NULL)
@@ -145,174 +285,1585 @@ bool is_valid_nucleotide_string(const char *s)
 }
 
 
+/*
+   On an error in the input, the reader stops there (input_failed()
+   doesn't return), but the records read before it are still shuffled
+   and written, and then the program exits with status 1.
+ */
+static jmp_buf input_error;
+static bool read_failed;
+
+static void input_failed()
+{
+	read_failed = true;
+	longjmp(input_error, 1);
+}
+
 /*
    Poor man's FASTA parser and validator.
 
-   Reads two lines from STDIN, validates them as FASTA format.
+   Finds the record (two lines) at the start of buf[0..len), validates it
+   as FASTA format, and NUL-terminates its ID and sequence in place.
+   Returns the number of bytes it takes, or 0 if the record is not
+   complete and more input follows (eof is false). buf must have room for
+   len+1 bytes, as the last line may lack a newline.
  */
-bool read_fasta_record(char* /*OUTPUT*/ fasta_id, int max_id_size,
-			char * /*output*/ fasta_sequence, int max_sequence_size,
-			unsigned long line)
+size_t parse_fasta_record(char *buf, size_t len, bool eof, unsigned long line,
+			char **id, char **sequence, long *seq_len)
 {
-	if (fgets(fasta_id,max_id_size,stdin)==NULL)
-		return false; //EOF - this is not an error
+	char *id_end, *seq, *seq_end;
+	size_t id_len;
+
+	id_end = memchr(buf, '\n', len);
+	seq_end = id_end ? memchr(id_end + 1, '\n', buf + len - (id_end + 1)) : NULL;
+	if (seq_end==NULL && !eof)
+		return 0;
 
 	//
 	// First line - FASTA ID
 	//
-
-	//The input line was too long, and was trimmed -  Abort the program.
-	//We don't do dynamic memory allocation here for simplicty.
-	size_t id_len = strlen(fasta_id);
-	if (id_len==max_id_size-1) {
-		fprintf(stderr,"Internal error: got a too-long input line (line %lu). Please incease the value of MAX_ID_SIZE (currently = %d)\n", line, MAX_ID_SIZE);
-		exit(1);
-	}
+	if (id_end==NULL)
+		id_end = buf + len;
+	id_len = id_end - buf + (id_end < buf + len);	//with the newline
 
 	//Too short ? not a valid FASTA identifier
 	if (id_len<2) {
 		fprintf(stderr,"Input error: got too-short ID line (line %lu).\n", line);
-		exit(1);
+		input_failed();
 	}
 
 	//Chomp the ID line
-	if (fasta_id[id_len-1]=='\n')
-		fasta_id[id_len-1]=0;
+	*id_end = 0;
 
 	//FASTA identifiers must begin with '>'
-	if (fasta_id[0]!='>') {
-		if (is_valid_nucleotide_string(fasta_id)) {
+	if (buf[0]!='>') {
+		if (is_valid_nucleotide_string(buf)) {
 			//A Multiline FASTA file - detect and warn the user
 			fprintf(stderr,"Input error: input looks like a multi-line FASTA file (line %lu should start with '>' but contains nucleotide sequence). This program requires a single-line FASTA file. Use 'fasta_formatter' to re-format the input file.\n", line);
-			exit(1);
+			input_failed();
 		}
 
 		//Otherwise - just complain
 		fprintf(stderr,"Input error: Invalid FASTA identifier on line %lu (expecting line with '>').\n", line);
-		exit(1);
+		input_failed();
 	}
 
 	/********************************
 	 * the nuceleotide sequence line
 	 *************************************/
 	++line;
-	if (fgets(fasta_sequence,max_sequence_size,stdin)==NULL) {
+	seq = id_end + 1;
+	if (seq >= buf + len) {
 		fprintf(stderr,"Error: Missing nucleotide sequence line in input FASTA file (line %lu\n", line);
-		exit(1);
+		input_failed();
 	}
 
-	//The input line (sequence line) was too long, and was trimmed -  Abort the program.
-	//We don't do dynamic memory allocation here for simplicty.
-	if (strlen(fasta_sequence)==max_sequence_size-1) {
-		fprintf(stderr,"Internal error: got a too-long input line (line %lu). Please incease the value of MAX_SEQUENCE_SIZE (currently = %d)\n", line, max_sequence_size);
-		exit(1);
-	}
+	//chomp
+	if (seq_end==NULL)
+		seq_end = buf + len;
+	*seq_end = 0;
 
 	//Valid nucleotide string?
-	//Chomp the ID line
-	size_t seq_len = strlen(fasta_sequence);
+	if (!is_valid_nucleotide_string(seq)) {
+		fprintf(stderr,"Input error: Invalid input file, expecting nucleotide sequence line on line %lu\n", line);
+		input_failed();
+	}
 
-	//chomp
-	if (fasta_sequence[seq_len-1]=='\n')
-		fasta_sequence[seq_len-1]=0;
+	*id = buf;
+	*sequence = seq;
+	*seq_len = seq_end - seq;
+	return seq_end - buf + (seq_end < buf + len);
+}
 
-	if (!is_valid_nucleotide_string(fasta_sequence)) {
-		fprintf(stderr,"Input error: Invalid input file, expecting nucleotide sequence line on line %lu\n", line);
-		exit(1);
+//Shuffle with the packed 2-bit engine instead of the ASCII one (-p).
+bool use_packed_engine = false;
+
+//Engine of the record being shuffled by this thread: with -p, and for .2bit records.
+__thread bool packed_engine = false;
+
+//Write packed records instead of FASTA (--format=packed).
+bool packed_output = false;
+
+//0-based number of the input record being shuffled by this thread.
+__thread unsigned long record_index = 0;
+
+//With several inputs, the file of that record (for --failures), else NULL.
+__thread const char *record_input = NULL;
+
+//Number of shuffling threads (-t), 0 to shuffle in the main thread.
+int n_threads = 0;
+unsigned long shuffle_seed;
+
+/*
+   With -t, every permutation is drawn from its own random stream, seeded
+   from the seed, the record number and the permutation number, so the
+   output does not depend on the number of threads nor on which thread
+   shuffles what. The generator is splitmix64, giving 31 bits per draw
+   like random().
+ */
+static __thread unsigned long long stream_state;
+
+static unsigned long long splitmix64(unsigned long long *x)
+{
+	unsigned long long z = (*x += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+long stream_random()
+{
+	return (long)(splitmix64(&stream_state) >> 33);
+}
+
+void stream_seed(unsigned long record, int permutation)
+{
+	unsigned long long x = shuffle_seed;
+
+	if (n_threads == 0)
+		return;
+	x = splitmix64(&x) ^ record;
+	x = splitmix64(&x) ^ (unsigned long long)permutation;
+	stream_state = splitmix64(&x);
+}
+
+/*
+   Prepares the shuffling graph for a sequence.
+   With the packed engine the sequence is packed into packed first, unless
+   it is NULL and packed already holds it. A packed sequence with several
+   ACGT stretches has its graphs rebuilt per shuffle by next_shuffle().
+ */
+void prepare_shuffle(int k, const char *sequence, long l, packed_dna *packed)
+{
+	double start = stats_clock(), span = trace_clock();
+
+	PROBE3(shuffle1__start, record_index, l, k);
+	if (packed_engine) {
+		if (sequence)
+			packdna_pack(packed, sequence, l);
+		shuffle1_packed_dna(packed, k);
+	} else
+		shuffle1(sequence, l, k);
+	stats_sample_memory();
+	PROBE3(shuffle1__done, record_index, l, k);
+	stats_add_time(PHASE_SHUFFLE1, start);
+	trace_span("shuffle1", span, record_index, l);
+}
+
+void next_shuffle(int k, long l, const packed_dna *packed, packed_dna *packed_out, char *t)
+{
+	double start = stats_clock(), span = trace_clock();
+
+	PROBE3(shuffle2__start, record_index, l, k);
+	if (packed_engine) {
+		shuffle2_packed_dna(packed, packed_out, k);
+		stats_sample_memory();
+		if (t)
+			packdna_unpack(packed_out, t);
+	} else
+		shuffle2(t);
+	PROBE3(shuffle2__done, record_index, l, k);
+	stats_add_time(PHASE_SHUFFLE2, start);
+	trace_span("shuffle2", span, record_index, l);
+}
+
+//--failures report, and the number of records without a new shuffle
+FILE *failures_file = NULL;
+unsigned long failed_records = 0;	//updated atomically
+
+/*
+   Adds a record for which every retry gave back the input to the
+   --failures report. The shuffling graph of the record must still be
+   built (or packed must hold it, with the packed engine).
+ */
+void report_failure(FILE *failures, int k, const char *id, long l, int retries, const packed_dna *packed)
+{
+	double logc;
+	const char *reason;
+
+	if (packed_engine)
+		logc = shuffle_packed_count_log10(packed, k, MAX_COUNT_VERTICES);
+	else
+		logc = shuffle_count_log10(MAX_COUNT_VERTICES);
+
+	if (k >= l)
+		reason = "k_not_below_length";
+	else if (logc < 0)
+		reason = "not_counted";
+	else if (logc == 0)
+		reason = "single_shuffle";	//no other sequence has the same k-let counts
+	else if (logc * retries < 12)
+		reason = "few_shuffles";	//all retries hit the input with p >= 1e-12
+	else
+		reason = "unlucky";
+
+	if (record_input)
+		fprintf(failures, "%s\t", record_input);
+	fprintf(failures, "%s\t%ld\t%d\t%s\t", id + 1, l, retries, reason);
+	if (logc < 0)
+		fprintf(failures, "NA\n");
+	else if (logc < 15)
+		fprintf(failures, "%.0f\n", pow(10, logc));
+	else
+		fprintf(failures, "%.3ge%.0f\n", pow(10, logc - floor(logc)), floor(logc));
+}
+
+//Bases per line of the FASTA output (--wrap), 0 for one line per sequence.
+long wrap_width = 0;
+
+//With --index, the index entries of the task being run by this thread.
+__thread faidx_buffer *task_index = NULL;
+
+/* bytes of the sequence lines of l bases */
+static long sequence_bytes(long l)
+{
+	return l + (wrap_width && l ? (l + wrap_width - 1) / wrap_width : 1);
+}
+
+/* writes the ID line of a sequence of l bases, and adds it to task_index */
+static void write_id(FILE *out, const char *id, const char *suffix, long l)
+{
+	size_t name_len;
+	char *name;
+
+	fprintf(out, "%s%s\n", id, suffix);
+	if (task_index == NULL)
+		return;
+	//as samtools faidx, the name ends at the first space; the suffix is
+	//added to it even after a description, to tell the copies of -o and -n apart
+	name_len = strcspn(id + 1, " \t");
+	if (asprintf(&name, "%.*s%s", (int) name_len, id + 1, suffix) < 0)
+		err(1,"asprintf failed");
+	faidx_add(task_index, name, strlen(name), l, ftell(out),
+		  wrap_width && wrap_width < l ? wrap_width : l,
+		  (wrap_width && wrap_width < l ? wrap_width : l) + 1);
+	free(name);
+}
+
+/* writes n bases of a sequence, the current line having col of them */
+static void write_bases(FILE *out, const char *s, long n, long *col)
+{
+	long m;
+
+	if (wrap_width == 0) {
+		fwrite(s, 1, n, out);
+		return;
+	}
+	for (; n > 0; s += m, n -= m, *col += m) {
+		if (*col == wrap_width) {
+			fputc('\n', out);
+			*col = 0;
+		}
+		m = wrap_width - *col < n ? wrap_width - *col : n;
+		fwrite(s, 1, m, out);
 	}
+}
 
-	return true;
+/* writes the l bases of s, wrapped with --wrap */
+static void write_sequence(FILE *out, const char *s, long l)
+{
+	long col = 0;
+
+	write_bases(out, s, l, &col);
+	fputc('\n', out);
+}
+
+/* writes a shuffle under id, packed_out with --format=packed, else t */
+static void write_shuffle(FILE *out, const char *id, const packed_dna *packed_out, const char *t, long l)
+{
+	if (packed_output)
+		packdna_write(out, id + 1, "", packed_out);
+	else {
+		write_id(out, id, "", l);
+		write_sequence(out, t, l);
+	}
 }
 
-void print_shuffle_sequence_perm(int k, int permutations_count, const char*id, const char*sequence)
+/*
+   Prints permutations first+1 to first+count of a sequence to out. All
+   of them when first is 0; with -t, a long record is split into several
+   ranges, and all but the first are counted as a part of a record.
+   The sequence is either sequence or, already packed, source.
+ */
+void print_shuffle_sequence_perm(FILE *out, int k, int first, int count, const char*id, const char*sequence, const packed_dna *source)
 {
-	int l;
+	long l;
 	char *t=NULL;
 	int i;
+	packed_dna packed, packed_out;
+	double start, span;
+	char suffix[32];
 
-	l = strlen(sequence);
-	if ((t = malloc(l + 1)) == NULL)
-		err(1,"malloc failed");
-	t[l] = '\0';
+	l = source ? source->length : (long) strlen(sequence);
+	if (!packed_output)	//packed records are written from packed_out
+		t = umem_alloc(l + 1);
 
-	shuffle1(sequence, l, k);
-	for (i = 0; i < permutations_count; i++) {
-		shuffle2(t);
-		printf("%s-perm%d\n", id, i+1);
-		printf("%s\n", t);
+	packdna_init(&packed_out);
+	if (source)
+		packed = *source;
+	else
+		packdna_init(&packed);
+	prepare_shuffle(k, source ? NULL : sequence, l, &packed);
+	for (i = first; i < first + count; i++) {
+		stream_seed(record_index, i);
+		next_shuffle(k, l, &packed, &packed_out, t);
+		start = stats_clock();
+		span = trace_clock();
+		if (packed_output) {
+			snprintf(suffix, sizeof(suffix), "-perm%d", i+1);
+			packdna_write(out, id + 1, suffix, &packed_out);
+		} else {
+			snprintf(suffix, sizeof(suffix), "-perm%d", i+1);
+			write_id(out, id, suffix, l);
+			write_sequence(out, t, l);
+		}
+		stats_add_time(PHASE_OUTPUT, start);
+		trace_span("write", span, record_index, l);
 	}
+	if (first == 0)
+		stats_record(l, -1, false);
+	else
+		stats_flush();
 	shuffle_reset();
+	if (!source)
+		packdna_free(&packed);
+	packdna_free(&packed_out);
 
-	free(t);
+	if (t)
+		umem_free(t, l + 1);
 }
 
-void print_shuffle_sequence_retries(int k, int retries_count, const char*id, const char*sequence)
+void print_shuffle_sequence_retries(FILE *out, FILE *failures, int k, int retries_count, const char*id, const char*sequence, const packed_dna *source)
 {
-	int l;
+	long l;
 	char *t=NULL;
 	int i;
+	packed_dna packed, packed_out;
+	double start, span;
 
-	l = strlen(sequence);
-	if ((t = malloc(l + 1)) == NULL)
-		err(1,"malloc failed");
-	t[l] = '\0';
+	l = source ? source->length : (long) strlen(sequence);
+	if (!packed_output)	//packed records are written from packed_out
+		t = umem_alloc(l + 1);
 
-	shuffle1(sequence, l, k);
+	packdna_init(&packed_out);
+	if (source)
+		packed = *source;
+	else
+		packdna_init(&packed);
+	prepare_shuffle(k, source ? NULL : sequence, l, &packed);
 
+	stream_seed(record_index, 0);
 	i = 0 ;
 	while ( i < retries_count ) {
-		shuffle2(t);
-		if (strncmp(sequence, t, l) != 0) {
-			printf("%s\n", id);
-			printf("%s\n", t);
+		next_shuffle(k, l, &packed, &packed_out, t);
+		start = stats_clock();
+		if (packed_output ? !packdna_equal(&packed, &packed_out)
+		    : (source ? packdna_compare(source, t) : strncmp(sequence, t, l)) != 0) {
+			stats_add_time(PHASE_COMPARE, start);
+			start = stats_clock();
+			span = trace_clock();
+			write_shuffle(out, id, &packed_out, t, l);
+			stats_add_time(PHASE_OUTPUT, start);
+			trace_span("write", span, record_index, l);
 			break;
 		}
+		stats_add_time(PHASE_COMPARE, start);
 		i++;
+		PROBE4(retry, record_index, l, k, i);
 	}
 	if (i>=retries_count) {
-		fprintf(stderr,"WARNING: failed to find new shuffle for sequence \"%s\" (%s) after %d retries\n", id, sequence, retries_count);
-		printf("%s\n", id);
-		printf("%s\n", t);
+		__atomic_add_fetch(&failed_records, 1, __ATOMIC_RELAXED);
+		if (failures)
+			report_failure(failures, k, id, l, retries_count, &packed);
+		start = stats_clock();
+		span = trace_clock();
+		write_shuffle(out, id, &packed_out, t, l);
+		stats_add_time(PHASE_OUTPUT, start);
+		trace_span("write", span, record_index, l);
 	}
+	stats_record(l, i, i>=retries_count);
 	shuffle_reset();
+	if (!source)
+		packdna_free(&packed);
+	packdna_free(&packed_out);
+
+	if (t)
+		umem_free(t, l + 1);
+}
+
+/*
+   The shuffling pipeline.
+
+   A reader thread reads the input in blocks of BLOCK_SIZE bytes or more,
+   parses the records in place and groups them into batches of views
+   into the block: up to BATCH_BASES bases times permutations, or
+   BATCH_RECORDS records. A record that fills a batch on its own goes
+   alone. Batches are shuffled by the main thread, or with -t N by a
+   work-stealing pool of N threads; there, the -n permutations of a long
+   record are also split into several tasks that idle threads can steal
+   (each task builds the graph again). Every task prints into its own
+   buffer, and a writer thread writes the buffers in input order.
+
+   The stages are connected by lock-free single-producer single-consumer
+   rings (ring.h): reader to main thread, and each shuffling thread to
+   the writer. At most window tasks and INFLIGHT_BYTES of output are in
+   flight, which bounds both the rings and the reorder buffer.
+
+   With --output, the size of every record in the output is known when
+   it is read, so the reader assigns each batch its offset in the output
+   file and reserves the space with fallocate(). The shuffling threads
+   then pwrite() their buffers in place, and the writer thread only
+   keeps the failures list in order and the counts. Without -z, tasks of
+   more than DIRECT_BYTES of output write it in place as it is printed,
+   so that it is never all in memory.
+
+   With --io-uring, the reader keeps URING_READS reads of URING_CHUNK
+   bytes in flight ahead of the parser, and the writer queues the task
+   buffers as asynchronous writes (see uring.h); a task is freed once its
+   write is complete.
+ */
+#define BLOCK_SIZE	(4L << 20)
+#define BATCH_BASES	(1L << 20)
+#define BATCH_RECORDS	4096
+#define TASK_BYTES	(64L << 20)
+#define DIRECT_BYTES	(64L << 20)
+#define INFLIGHT_BYTES	(1L << 30)
+#define RESERVE_BYTES	(256L << 20)
+#define URING_READS	8
+#define URING_CHUNK	(1L << 20)
+#define URING_WRITES	16
 
+typedef struct block {
+	char *data;
+	size_t len, alloc;	//alloc leaves room for a terminator
+	bool mapped;		//data is len bytes of a file mapped with mmap()
+	int refs;		//updated atomically
+} block;
+
+typedef struct record_view {
+	const char *id;
+	const char *sequence;
+	long length;
+	packed_dna *packed;	//instead of sequence, from .2bit input
+} record_view;
+
+typedef struct batch {
+	block *bk;
+	record_view *records;
+	int n_records, records_alloc;
+	int input;		//number of the input file
+	unsigned long first_record;	//in its input
+	long weight;		//bases times permutations
+	long bytes;		//input bytes, as FASTA
+	long input_bytes;	//in the input file, for --progress
+	off_t out_offset;	//with --output
+	int refs;		//tasks using the batch, updated atomically
+} batch;
+
+typedef struct task {
+	unsigned long seq;	//position in the output
+	batch *b;
+	int first_perm, n_perms;
+	long cost;		//estimated output bytes
+	off_t offset;		//in the --output file
+	long out_bytes;		//expected size of out, with --output
+	bgzf_buffer bgzf;	//with -z, the blocks of out
+	size_t text_size;	//of out, before -z
+	faidx_buffer index;	//with --index, the records of out
+	char *out, *failures;
+	size_t out_size, failures_size;
+} task;
+
+//Options of the run, for the pipeline threads
+static struct {
+	int k, n, max_retries;
+	bool show_original;
+} opts;
+
+static workq *pool;		//with -t
+static ring *to_shuffler;	//without -t
+static ring **to_writer;	//one per shuffling thread
+static task end_of_input;	//pushed to to_shuffler last
+static unsigned long window_size;
+static unsigned long submitted, written;	//tasks, read and written atomically
+static long inflight;		//bytes, updated atomically
+static bool reading_done;
+static unsigned long records_read;
+static int reading_input;	//number of the input file being read
+static unsigned long input_first_record;	//records_read when it started
+static char **input_paths;	//NULL to read STDIN
+static int n_inputs = 1;
+static char **output_paths, **gzi_paths, **index_paths;	//of each input, or NULL
+static int output_fd = -1;	//with --output
+static off_t output_size, output_reserved;
+static bool use_io_uring;
+static uring_input *uring_in;	//with --io-uring, NULL if not possible
+static uring_output *uring_out;
+static gzin *gz_in;		//compressed input
+static bool bgzf_output;	//-z
+static bgzf_index gzi;		//with --gzi
+static FILE *index_file;	//--index, of the input being written
+static bool index_output;
+static unsigned char input_head[GZIN_MAGIC_BYTES];
+static size_t input_head_len, input_head_pos;
+//for --progress: decompressed bytes read and given to batches, compressed bytes given
+static off_t gz_read, gz_plain_batched, gz_batched;
+static twobit *twobit_in;	//.2bit input
+static unsigned char *twobit_image;
+static size_t twobit_size;
+static bool twobit_mapped;
+static faidx *fai;		//with --regions
+static FILE *regions_file;
+static const char *regions_path, *fai_path;
+static double batch_start, batch_span;	//clocks of the batch being read
+
+static ssize_t read_file(void *buf, size_t len)
+{
+	return uring_in ? uring_input_read(uring_in, buf, len) : read(STDIN_FILENO, buf, len);
+}
+
+/* reads the input as it is, starting with the bytes read to tell its format */
+static ssize_t read_raw(void *buf, size_t len)
+{
+	size_t n;
+
+	if (input_head_pos < input_head_len) {
+		n = input_head_len - input_head_pos < len ? input_head_len - input_head_pos : len;
+		memcpy(buf, input_head + input_head_pos, n);
+		input_head_pos += n;
+		return n;
+	}
+	return read_file(buf, len);
+}
+
+/* reads the input, decompressed if it is gzip or BGZF */
+static ssize_t read_input(void *buf, size_t len)
+{
+	ssize_t got;
+
+	if (!gz_in)
+		return read_raw(buf, len);
+	if ((got = gzin_read(gz_in, buf, len)) > 0)
+		gz_read += got;
+	return got;
+}
+
+/*
+   Maps a .2bit input in memory, or reads it all if it is not a file.
+   Its sequences are always shuffled with the packed engine.
+ */
+static void open_twobit()
+{
+	struct stat st;
+	size_t alloc;
+	ssize_t got;
+
+	if (fstat(STDIN_FILENO, &st)==0 && S_ISREG(st.st_mode) && st.st_size > 0
+	    && (twobit_image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, STDIN_FILENO, 0)) != MAP_FAILED) {
+		twobit_size = st.st_size;
+		twobit_mapped = true;
+	} else {
+		alloc = 1 << 20;
+		twobit_image = umem_buffer_alloc(alloc);
+		while ((got = read_raw(twobit_image + twobit_size, alloc - twobit_size)) > 0)
+			if ((twobit_size += got) == alloc) {
+				twobit_image = umem_buffer_realloc(twobit_image, alloc, 2 * alloc);
+				alloc *= 2;
+			}
+		if (got < 0) {
+			warn("read failed");
+			input_failed();
+		}
+		//as a block: len bytes and a terminator
+		twobit_image = umem_buffer_realloc(twobit_image, alloc, twobit_size + 1);
+	}
+	twobit_in = twobit_open(twobit_image, twobit_size);
+}
+
+/* tells the format of the input from its first bytes */
+static void open_input()
+{
+	ssize_t got;
+	int format;
+
+	while (input_head_len < GZIN_MAGIC_BYTES
+	       && (got = read_file(input_head + input_head_len, GZIN_MAGIC_BYTES - input_head_len)) != 0) {
+		if (got < 0) {
+			warn("read failed");
+			input_failed();
+		}
+		input_head_len += got;
+	}
+	if ((format = gzin_format(input_head, input_head_len)) != GZIN_NONE) {
+		gz_in = gzin_open(read_raw, format, n_threads ? n_threads : 1);
+		gz_read = gz_plain_batched = gz_batched = 0;
+	} else if (twobit_detect(input_head, input_head_len))
+		open_twobit();
+}
+
+static block *new_block(size_t alloc)
+{
+	block *bk;
+
+	if ((bk = calloc(1, sizeof(block)))==NULL)
+		err(1,"calloc failed");
+	bk->data = umem_buffer_alloc(alloc + 1);	//within --max-memory
+	bk->alloc = alloc;
+	bk->refs = 1;
+	return bk;
+}
+
+static void block_release(block *bk)
+{
+	if (__atomic_sub_fetch(&bk->refs, 1, __ATOMIC_ACQ_REL) > 0)
+		return;
+	if (bk->mapped)
+		munmap(bk->data, bk->len);
+	else
+		umem_buffer_free(bk->data, bk->alloc + 1);
+	free(bk);
+}
+
+static batch *filling;	//the batch the reader adds records to
+
+static batch *new_batch(block *bk)
+{
+	batch *b;
+
+	if ((b = calloc(1, sizeof(batch)))==NULL)
+		err(1,"calloc failed");
+	b->bk = bk;
+	__atomic_add_fetch(&bk->refs, 1, __ATOMIC_ACQ_REL);
+	b->input = reading_input;
+	b->first_record = records_read - input_first_record;
+	b->out_offset = output_size;
+	filling = b;
+	return b;
+}
+
+/* bytes of output of permutations first+1 to first+count of a record */
+static long output_bytes(const record_view *v, int first, int count)
+{
+	long id = strlen(v->id), bytes = 0;
+	long digits, power;
+	int i;
+
+	if (opts.show_original && first == 0)
+		bytes += id + strlen("-unshuffled\n") + sequence_bytes(v->length);
+	if (opts.n == 1)
+		return bytes + id + 1 + sequence_bytes(v->length);
+	for (i = first + 1; i <= first + count; i++) {
+		for (digits = 1, power = 10; i >= power; digits++, power *= 10)
+			;
+		bytes += id + strlen("-perm") + digits + 1 + sequence_bytes(v->length);
+	}
+	return bytes;
+}
+
+/* extends the preallocated part of the output file to at least end */
+static void reserve_output(off_t end)
+{
+	off_t size;
+
+	if (output_reserved < 0 || end <= output_reserved)
+		return;
+	size = end - output_reserved > RESERVE_BYTES ? end - output_reserved : RESERVE_BYTES;
+	if (fallocate(output_fd, FALLOC_FL_KEEP_SIZE, output_reserved, size) == 0)
+		output_reserved += size;
+	else if (errno == EOPNOTSUPP || errno == ENOSYS)
+		output_reserved = -1;	//pwrite() will extend the file
+	else
+		err(1,"can't preallocate the output file");
+}
+
+static void batch_add(batch *b, const char *id, const char *sequence, long l, long bytes, packed_dna *packed)
+{
+	record_view *v;
+
+	if (b->n_records == b->records_alloc) {
+		b->records_alloc = b->records_alloc ? 2 * b->records_alloc : 64;
+		if ((b->records = realloc(b->records, b->records_alloc * sizeof(record_view)))==NULL)
+			err(1,"realloc failed");
+	}
+	v = &b->records[b->n_records++];
+	v->id = id;
+	v->sequence = sequence;
+	v->length = l;
+	v->packed = packed;
+	b->weight += l * opts.n;
+	b->bytes += bytes;
+	b->input_bytes += packed ? PACKDNA_BYTES(l) : bytes;	//as stored in .2bit input
+	if (output_fd >= 0) {
+		output_size += output_bytes(v, 0, opts.n);
+		reserve_output(output_size);
+	}
+}
+
+static void batch_release(batch *b)
+{
+	int i;
+
+	if (__atomic_sub_fetch(&b->refs, 1, __ATOMIC_ACQ_REL) > 0)
+		return;
+	for (i = 0; i < b->n_records; i++)
+		if (b->records[i].packed) {
+			twobit_release(b->records[i].packed);
+			free(b->records[i].packed);	//and the ID after it
+		}
+	block_release(b->bk);
+	free(b->records);
+	free(b);
+}
+
+/* prints a packed sequence and a newline, unpacking a piece at a time */
+static void write_packed(FILE *out, const packed_dna *p)
+{
+	char chunk[65536];
+	long i, n, col = 0;
+
+	for (i = 0; i < p->length; i += n) {
+		n = p->length - i < (long) sizeof(chunk) ? p->length - i : (long) sizeof(chunk);
+		packdna_unpack_range(p, i, n, chunk);
+		write_bases(out, chunk, n, &col);
+	}
+	fputc('\n', out);
+}
+
+/* writes the original of a record as a packed record, for -o */
+static void write_original(FILE *out, const record_view *v)
+{
+	packed_dna p;
+
+	if (v->packed) {
+		packdna_write(out, v->id + 1, "-unshuffled", v->packed);
+		return;
+	}
+	packdna_init(&p);
+	packdna_pack(&p, v->sequence, v->length);
+	packdna_write(out, v->id + 1, "-unshuffled", &p);
+	packdna_free(&p);
+}
+
+static int shuffled_input;	//input of the last task, without -t
+
+/* the output of a task written straight to its place in the --output file */
+typedef struct direct_output {
+	off_t offset;
+	size_t size;
+} direct_output;
+
+static ssize_t direct_write(void *cookie, const char *buf, size_t size)
+{
+	direct_output *d = cookie;
+	size_t done = 0;
+	ssize_t n;
+
+	while (done < size) {
+		if ((n = pwrite(output_fd, buf + done, size - done, d->offset + d->size)) < 0)
+			return -1;
+		done += n;
+		d->size += n;
+	}
+	return done;
+}
+
+/* only tells the position, for ftell() */
+static int direct_seek(void *cookie, off64_t *offset, int whence)
+{
+	direct_output *d = cookie;
+
+	if (whence != SEEK_CUR || *offset != 0)
+		return -1;
+	*offset = d->size;
+	return 0;
+}
+
+static void run_task(void *arg, int worker)
+{
+	task *t = arg;
+	batch *b = t->b;
+	FILE *out, *failures = NULL;
+	const record_view *v;
+	double start, span;
+	int i;
+	//large outputs are not buffered, when their place is known
+	direct_output direct = { t->offset, 0 };
+	bool is_direct = output_fd >= 0 && !bgzf_output && t->out_bytes > DIRECT_BYTES;
+
+	if (n_threads) {
+		trace_thread_name("worker");
+		set_randfunc(stream_random);
+		set_shuffle_reproducible(opts.n > 1);	//permutations may be split between tasks
+	}
+	task_index = index_output ? &t->index : NULL;
+	record_input = n_inputs > 1 ? input_paths[b->input] : NULL;
+	if (!n_threads && b->input != shuffled_input) {
+		//every input is shuffled as if it was alone
+		shuffled_input = b->input;
+		srandom(shuffle_seed);
+	}
+	if (is_direct) {
+		if ((out = fopencookie(&direct, "w", (cookie_io_functions_t) { .write = direct_write, .seek = direct_seek }))==NULL)
+			err(1,"fopencookie failed");
+		setvbuf(out, NULL, _IOFBF, URING_CHUNK);
+	} else if ((out = open_memstream(&t->out, &t->out_size))==NULL)
+		err(1,"open_memstream failed");
+	if (failures_file && (failures = open_memstream(&t->failures, &t->failures_size))==NULL)
+		err(1,"open_memstream failed");
+
+	for (i = 0; i < b->n_records; i++) {
+		v = &b->records[i];
+		record_index = b->first_record + i;
+		packed_engine = use_packed_engine || v->packed;
+		PROBE3(record__start, record_index, v->length, opts.k);
+		progress_record_start(v->length);
+		if (opts.show_original && t->first_perm == 0) {
+			start = stats_clock();
+			span = trace_clock();
+			if (packed_output)
+				write_original(out, v);
+			else {
+				write_id(out, v->id, "-unshuffled", v->length);
+				if (v->packed)
+					write_packed(out, v->packed);
+				else
+					write_sequence(out, v->sequence, v->length);
+			}
+			stats_add_time(PHASE_OUTPUT, start);
+			trace_span("write", span, record_index, v->length);
+		}
+		if (opts.n>1)
+			print_shuffle_sequence_perm(out, opts.k, t->first_perm, t->n_perms, v->id, v->sequence, v->packed);
+		else
+			print_shuffle_sequence_retries(out, failures, opts.k, opts.max_retries, v->id, v->sequence, v->packed);
+		PROBE3(record__done, record_index, v->length, opts.k);
+		progress_record_end();
+	}
+	if (fclose(out) != 0)
+		err(1,"write failed");
+	if (failures)
+		fclose(failures);
+	t->text_size = t->out_size;
+	if (is_direct) {
+		if ((long) direct.size != t->out_bytes)
+			errx(1,"internal error: %zu bytes of output instead of %ld", direct.size, t->out_bytes);
+		t->text_size = direct.size;
+	}
+
+	if (bgzf_output) {
+		start = stats_clock();
+		span = trace_clock();
+		bgzf_compress(&t->bgzf, t->out, t->out_size, BGZF_DEFAULT_LEVEL);
+		free(t->out);
+		t->out = (char *) t->bgzf.data;
+		t->out_size = t->bgzf.size;
+		t->bgzf.data = NULL;
+		stats_add_time(PHASE_COMPRESS, start);
+		trace_span("compress", span, b->first_record, -1);
+	}
+
+	if (output_fd >= 0 && !is_direct) {
+		start = stats_clock();
+		span = trace_clock();
+		if ((long) t->out_size != t->out_bytes)
+			errx(1,"internal error: %zu bytes of output instead of %ld", t->out_size, t->out_bytes);
+		for (size_t done = 0; done < t->out_size; ) {
+			ssize_t n = pwrite(output_fd, t->out + done, t->out_size - done, t->offset + done);
+			if (n < 0)
+				err(1,"write failed");
+			done += n;
+		}
+		free(t->out);
+		t->out = NULL;
+		t->out_size = 0;
+		stats_add_time(PHASE_OUTPUT, start);
+		trace_span("pwrite", span, b->first_record, -1);
+	}
+
+	//never full: a ring holds a whole window
+	ring_push(to_writer[worker], t);
+}
+
+/* frees a task once its output is written */
+static void task_written(void *arg)
+{
+	task *t = arg;
+
+	__atomic_sub_fetch(&inflight, t->cost, __ATOMIC_RELEASE);
+	batch_release(t->b);
+	free(t->out);
+	free(t->failures);
+	bgzf_buffer_free(&t->bgzf);
+	faidx_buffer_free(&t->index);
 	free(t);
 }
 
+/* starts the output of input i: its file, with several inputs, and its --index */
+static void start_output(int i)
+{
+	if (output_paths[i] && output_fd < 0 && freopen(output_paths[i], "w", stdout)==NULL)
+		err(1,"can't create output file '%s'", output_paths[i]);
+	if (index_paths[i] && (index_file = fopen(index_paths[i], "w"))==NULL)
+		err(1,"can't create index file '%s'", index_paths[i]);
+	if (use_io_uring && output_fd < 0)
+		uring_out = uring_output_open(STDOUT_FILENO, URING_WRITES);
+}
+
+/* ends the output of input i, and writes its indexes */
+static void end_output(int i)
+{
+	double start, span;
+
+	if (bgzf_output) {
+		if (uring_out)
+			uring_output_write(uring_out, bgzf_eof, sizeof(bgzf_eof), NULL, NULL);
+		else if (fwrite(bgzf_eof, 1, sizeof(bgzf_eof), stdout) != sizeof(bgzf_eof))
+			err(1,"write failed");
+	}
+	if (uring_out) {
+		start = stats_clock();
+		span = trace_clock();
+		uring_output_close(uring_out);
+		uring_out = NULL;
+		stats_add_time(PHASE_OUTPUT, start);
+		trace_span("write", span, -1, -1);
+	}
+	if (output_paths[i] && output_fd < 0 && fflush(stdout)!=0)
+		err(1,"can't write output file '%s'", output_paths[i]);
+	if (gzi_paths[i] && !bgzf_index_write(&gzi, gzi_paths[i]))
+		err(1,"can't write index file '%s'", gzi_paths[i]);
+	bgzf_index_free(&gzi);
+	if (index_file && fclose(index_file)!=0)
+		err(1,"can't write index file '%s'", index_paths[i]);
+	index_file = NULL;
+}
+
+static void *writer_main(void *arg)
+{
+	task **pending, *t;
+	unsigned long n_rings = n_threads ? n_threads : 1, i, first_record;
+	off_t text_offset = 0;	//in the output before -z, for --index
+	double start, span;
+	unsigned spins = 0;
+	int current = 0;	//input whose output is being written
+
+	(void) arg;
+	trace_thread_name("writer");
+	if ((pending = calloc(window_size, sizeof(task *)))==NULL)
+		err(1,"calloc failed");
+	for (;;) {
+		if ((t = pending[written % window_size]) == NULL) {
+			//collect finished tasks into the reorder buffer
+			for (i = 0; i < n_rings; i++)
+				while ((t = ring_pop(to_writer[i])) != NULL) {
+					pending[t->seq % window_size] = t;
+					spins = 0;
+				}
+			if (pending[written % window_size] == NULL) {
+				if (__atomic_load_n(&reading_done, __ATOMIC_ACQUIRE)
+				    && written == __atomic_load_n(&submitted, __ATOMIC_ACQUIRE))
+					break;
+				if (uring_out)
+					uring_output_submit(uring_out);
+				backoff(&spins);
+			}
+			continue;
+		}
+		pending[written % window_size] = NULL;
+		while (current < t->b->input) {
+			end_output(current);
+			start_output(++current);
+			text_offset = 0;
+		}
+
+		start = stats_clock();
+		span = trace_clock();
+		first_record = t->b->first_record;
+		if (t->failures)
+			fwrite(t->failures, 1, t->failures_size, failures_file);
+		if (bgzf_output)
+			bgzf_index_add(&gzi, &t->bgzf);
+		if (index_file && !faidx_write(index_file, &t->index, text_offset))
+			err(1,"can't write the index");
+		text_offset += t->text_size;
+		if (t->first_perm + t->n_perms >= opts.n)	//last part of its records
+			progress_records_done(t->b->n_records, t->b->input_bytes);
+		if (uring_out && t->out_size)
+			uring_output_write(uring_out, t->out, t->out_size, task_written, t);
+		else {
+			if (t->out_size && fwrite(t->out, 1, t->out_size, stdout) != t->out_size)
+				err(1,"write failed");
+			task_written(t);
+		}
+		stats_add_time(PHASE_OUTPUT, start);
+		trace_span("write", span, first_record, -1);
+		__atomic_store_n(&written, written + 1, __ATOMIC_RELEASE);
+	}
+	end_output(current);
+	while (current + 1 < n_inputs && !read_failed) {	//inputs without records
+		start_output(++current);
+		end_output(current);
+	}
+	free(pending);
+	stats_flush();
+	return NULL;
+}
+
+/* waits for room in the window, then hands a task to the shuffling stage */
+static void submit(batch *b, int first_perm, int n_perms, long cost, off_t offset, long out_bytes)
+{
+	task *t;
+	double span = trace_clock();
+	unsigned spins = 0;
+	bool waited = false;
+
+	if ((t = calloc(1, sizeof(task)))==NULL)
+		err(1,"calloc failed");
+	t->b = b;
+	t->first_perm = first_perm;
+	t->n_perms = n_perms;
+	t->cost = cost;
+	t->offset = offset;
+	t->out_bytes = out_bytes;
+	__atomic_add_fetch(&b->refs, 1, __ATOMIC_ACQ_REL);
+
+	for (;;) {
+		unsigned long done = __atomic_load_n(&written, __ATOMIC_ACQUIRE);
+
+		if (submitted - done < window_size
+		    && (submitted == done || __atomic_load_n(&inflight, __ATOMIC_ACQUIRE) + cost <= INFLIGHT_BYTES))
+			break;
+		waited = true;
+		backoff(&spins);
+	}
+	if (waited)
+		trace_span("reorder stall", span, b->first_record, -1);
+	t->seq = submitted;
+	__atomic_add_fetch(&inflight, cost, __ATOMIC_RELEASE);
+	__atomic_store_n(&submitted, submitted + 1, __ATOMIC_RELEASE);
+
+	if (pool)
+		workq_submit(pool, t);
+	else
+		while (!ring_push(to_shuffler, t))
+			backoff(&spins);
+}
+
+/* submits a batch: whole, or split by permutations if it is one long record */
+static void submit_batch(batch *b)
+{
+	long l = b->weight / opts.n, bytes;
+	off_t offset = b->out_offset;
+	int perms, first, count;
+
+	b->refs = 1;	//ours, until all tasks are submitted
+	if (n_threads && opts.n > 1 && b->n_records == 1 && b->weight >= BATCH_BASES) {
+		perms = (opts.n + 2 * n_threads - 1) / (2 * n_threads);
+		if (perms > 1 && l * perms > TASK_BYTES)
+			perms = TASK_BYTES / l > 1 ? TASK_BYTES / l : 1;
+		for (first = 0; first < opts.n; first += perms) {
+			count = first + perms <= opts.n ? perms : opts.n - first;
+			bytes = output_fd >= 0 ? output_bytes(&b->records[0], first, count) : 0;
+			submit(b, first, count, (l + 1) * count, offset, bytes);
+			offset += bytes;
+		}
+	} else
+		submit(b, 0, opts.n, b->bytes * opts.n, offset, output_size - offset);
+	batch_release(b);
+}
+
+/* submits a batch, and times the reading of the next one from now */
+static void flush_batch(batch *b)
+{
+	off_t done;
+
+	//--progress compares the input bytes to the size of the files: count the
+	//compressed bytes behind the batch, in proportion of its decompressed bytes
+	if (gz_in) {
+		gz_plain_batched += b->input_bytes;
+		done = (double) gz_plain_batched / gz_read * gzin_offset(gz_in);
+		b->input_bytes = done - gz_batched;
+		gz_batched = done;
+	}
+	stats_add_time(PHASE_PARSE, batch_start);
+	trace_span("read batch", batch_span, b->first_record, -1);
+	submit_batch(b);
+	batch_start = stats_clock();
+	batch_span = trace_clock();
+}
+
+/* submits the records of b, if any */
+static void end_batch(batch *b)
+{
+	if (b->n_records > 0)
+		flush_batch(b);
+	else
+		batch_release(b);
+	filling = NULL;
+}
+
+/* adds a record to b, or to the next batch (returned) if b is full */
+static batch *add_record(batch *b, block *bk, const char *id, const char *sequence, long l,
+			 long bytes, packed_dna *packed)
+{
+	//a long record goes alone
+	if (b->n_records > 0 && b->weight + l * opts.n > BATCH_BASES) {
+		flush_batch(b);
+		b = new_batch(bk);
+	}
+	batch_add(b, id, sequence, l, bytes, packed);
+	records_read++;
+	if (b->weight >= BATCH_BASES || b->n_records >= BATCH_RECORDS) {
+		flush_batch(b);
+		b = new_batch(bk);
+	}
+	return b;
+}
+
+static void read_fasta()
+{
+	block *bk = new_block(BLOCK_SIZE), *next;
+	batch *b;
+	size_t pos = 0, used;
+	ssize_t got;
+	unsigned long line = 1;
+	bool eof = false;
+	char *id, *sequence;
+	long seq_len;
+
+	b = new_batch(bk);
+	for (;;) {
+		if (pos == bk->len && eof)
+			break;
+		used = pos < bk->len || eof ? parse_fasta_record(bk->data + pos, bk->len - pos, eof, line, &id, &sequence, &seq_len) : 0;
+		if (used == 0) {
+			//the next record is not complete: read more, in a new block if this one is full
+			if (bk->len == bk->alloc) {
+				end_batch(b);
+				next = new_block(bk->len - pos > BLOCK_SIZE / 2 ? 2 * (bk->len - pos) : BLOCK_SIZE);
+				memcpy(next->data, bk->data + pos, bk->len - pos);
+				next->len = bk->len - pos;
+				block_release(bk);
+				bk = next;
+				pos = 0;
+				b = new_batch(bk);
+			}
+			//fill the block, so that a long record is not parsed again after every read
+			while ((got = read_input(bk->data + bk->len, bk->alloc - bk->len)) > 0) {
+				bk->len += got;
+				if (bk->len == bk->alloc)
+					break;
+			}
+			if (got < 0) {
+				warn("read failed");
+				input_failed();
+			}
+			eof = got == 0;
+			continue;
+		}
+		line+=2;
+		b = add_record(b, bk, id, sequence, seq_len, used, NULL);
+		pos += used;
+	}
+	end_batch(b);
+	block_release(bk);
+}
+
+/* the records of a .2bit input, each packed in place in the file image */
+static void read_twobit()
+{
+	block *bk = new_block(0);
+	batch *b;
+	packed_dna *p;
+	const char *name;
+	char *id;
+	long i;
+
+	//the batches hold the file image, as they hold the blocks of FASTA input
+	umem_buffer_free(bk->data, 1);
+	bk->data = (char *) twobit_image;
+	bk->len = bk->alloc = twobit_size;
+	bk->mapped = twobit_mapped;
+	b = new_batch(bk);
+	for (i = 0; i < twobit_count(twobit_in); i++) {
+		name = twobit_name(twobit_in, i);
+		if ((p = malloc(sizeof(packed_dna) + strlen(name) + 2))==NULL)
+			err(1,"malloc failed");
+		id = (char *) (p + 1);
+		id[0] = '>';
+		strcpy(id + 1, name);
+		twobit_sequence(twobit_in, i, p);
+		b = add_record(b, bk, id, NULL, p->length, strlen(id) + p->length + 2, p);
+	}
+	end_batch(b);
+	block_release(bk);
+	twobit_close(twobit_in);
+	twobit_in = NULL;
+	twobit_image = NULL;
+	twobit_size = 0;
+	twobit_mapped = false;
+}
+
+/* opens the BED file of --regions, and the index of the input */
+static void open_regions()
+{
+	const char *index = fai_path;
+	char path[PATH_MAX];
+	unsigned char head[GZIN_MAGIC_BYTES];
+	struct stat st;
+	ssize_t n;
+
+	if (fstat(STDIN_FILENO, &st)!=0 || !S_ISREG(st.st_mode))
+		errx(1,"--regions needs the input FASTA file on STDIN, not a pipe");
+	n = pread(STDIN_FILENO, head, sizeof(head), 0);
+	if (n > 0 && (gzin_format(head, n) != GZIN_NONE || twobit_detect(head, n)))
+		errx(1,"--regions needs an uncompressed FASTA input");
+	if (index == NULL) {
+		n = readlink("/proc/self/fd/0", path, sizeof(path) - strlen(".fai") - 1);
+		if (n < 0 || n == (ssize_t) (sizeof(path) - strlen(".fai") - 1))
+			errx(1,"can't tell the name of the input file: use --fai");
+		strcpy(path + n, ".fai");
+		index = path;
+	}
+	if ((fai = faidx_load(index))==NULL)
+		err(1,"can't read index '%s' (see samtools faidx)", index);
+	if ((regions_file = fopen(regions_path, "r"))==NULL)
+		err(1,"can't read regions file '%s'", regions_path);
+}
+
+/* the regions listed in the BED file, read through the index of the input */
+static void read_regions()
+{
+	block *bk = new_block(BLOCK_SIZE);
+	batch *b = new_batch(bk);
+	const faidx_entry *e;
+	char *line = NULL, *name, *id, *sequence;
+	size_t line_alloc = 0, need;
+	unsigned long line_no = 0;
+	long start, end, l;
+	int id_len, rc;
+
+	open_regions();
+	while (getline(&line, &line_alloc, regions_file) > 0) {
+		line_no++;
+		if ((rc = bed_parse(line, &name, &start, &end)) == 0)
+			continue;
+		if (rc < 0) {
+			warnx("%s:%lu: invalid BED line", regions_path, line_no);
+			input_failed();
+		}
+		if ((e = faidx_find(fai, name)) == NULL) {
+			warnx("%s:%lu: no sequence '%s' in the index", regions_path, line_no, name);
+			input_failed();
+		}
+		if (end > e->length) {
+			warnx("%s:%lu: region beyond the end of '%s' (%ld bases)", regions_path, line_no, name, e->length);
+			input_failed();
+		}
+
+		//the ID and the bases (with their line ends, until dropped) go in the block
+		id_len = snprintf(NULL, 0, ">%s:%ld-%ld", name, start + 1, end);
+		need = id_len + 1 + faidx_span(e, start, end) + 1;
+		if (bk->len + need > bk->alloc) {
+			end_batch(b);
+			block_release(bk);
+			bk = new_block(need > BLOCK_SIZE ? need : BLOCK_SIZE);
+			b = new_batch(bk);
+		}
+		id = bk->data + bk->len;
+		sprintf(id, ">%s:%ld-%ld", name, start + 1, end);
+		sequence = id + id_len + 1;
+		if ((l = faidx_fetch(STDIN_FILENO, e, start, end, sequence)) < 0) {
+			warn("read failed");
+			input_failed();
+		}
+		if (l != end - start || !is_valid_nucleotide_string(sequence)) {
+			warnx("%s:%lu: the input doesn't match its index at '%s'", regions_path, line_no, name);
+			input_failed();
+		}
+		bk->len += id_len + 1 + l + 1;
+		b = add_record(b, bk, id, sequence, l, id_len + 1 + l + 1, NULL);
+	}
+	if (ferror(regions_file))
+		err(1,"can't read '%s'", regions_path);
+	free(line);
+	end_batch(b);
+	block_release(bk);
+	faidx_free(fai);
+	fai = NULL;
+	fclose(regions_file);
+}
+
+/* makes input file i the STDIN of the process */
+static void open_input_file(int i)
+{
+	int fd;
+
+	if ((fd = open(input_paths[i], O_RDONLY)) < 0)
+		err(1,"can't open input file '%s'", input_paths[i]);
+	if (fd != STDIN_FILENO) {
+		if (dup2(fd, STDIN_FILENO) < 0)
+			err(1,"dup2 failed");
+		close(fd);
+	}
+}
+
+/* tells the shuffler thread that the input is over */
+static void push_end_of_input()
+{
+	unsigned spins = 0;
+
+	while (!ring_push(to_shuffler, &end_of_input))
+		backoff(&spins);
+}
+
+static void *reader_main(void *arg)
+{
+	(void) arg;
+	trace_thread_name("reader");
+	batch_start = stats_clock();
+	batch_span = trace_clock();
+	if (setjmp(input_error)) {
+		//the records read before the error are written, the inputs left are not read
+		if (filling)
+			end_batch(filling);
+		reading_input = n_inputs;
+	}
+	for (; reading_input < n_inputs; reading_input++) {
+		if (reading_input > 0)	//main() opened the first one
+			open_input_file(reading_input);
+		input_first_record = records_read;
+		if (regions_path) {
+			read_regions();
+			continue;
+		}
+		if (use_io_uring)
+			uring_in = uring_input_open(STDIN_FILENO, URING_READS, URING_CHUNK);
+		input_head_len = input_head_pos = 0;
+		open_input();
+		if (twobit_in)
+			read_twobit();
+		else
+			read_fasta();
+		if (gz_in)
+			gzin_close(gz_in);
+		if (uring_in)
+			uring_input_close(uring_in);
+		gz_in = NULL;
+		uring_in = NULL;
+	}
+	stats_flush();
+
+	if (!pool)
+		push_end_of_input();
+	return NULL;
+}
+
+/*
+   Shuffles all the input, in n_threads threads if not 0, else in the
+   calling thread. Returns the number of records.
+ */
+unsigned long shuffle_all()
+{
+	pthread_t reader, writer;
+	unsigned long n_rings = n_threads ? n_threads : 1, i;
+	unsigned spins = 0;
+	task *t;
+	int rc;
+
+	window_size = 16 * n_rings + 16;
+	if ((to_writer = calloc(n_rings, sizeof(ring *)))==NULL)
+		err(1,"calloc failed");
+	for (i = 0; i < n_rings; i++)
+		to_writer[i] = ring_create(window_size);
+	if (n_threads)
+		pool = workq_create(n_threads, window_size, run_task);
+	else
+		to_shuffler = ring_create(window_size);
+
+	if ((rc = pthread_create(&writer, NULL, writer_main, NULL))!=0
+	    || (rc = pthread_create(&reader, NULL, reader_main, NULL))!=0) {
+		errno = rc;
+		err(1,"pthread_create failed");
+	}
+
+	if (pool) {
+		pthread_join(reader, NULL);
+		workq_finish(pool);
+	} else {
+		trace_thread_name("shuffler");
+		while ((t = ring_pop(to_shuffler)) != &end_of_input) {
+			if (t == NULL) {
+				backoff(&spins);
+				continue;
+			}
+			spins = 0;
+			run_task(t, 0);
+		}
+		pthread_join(reader, NULL);
+		ring_free(to_shuffler);
+	}
+	__atomic_store_n(&reading_done, true, __ATOMIC_RELEASE);
+	pthread_join(writer, NULL);
+
+	for (i = 0; i < n_rings; i++)
+		ring_free(to_writer[i]);
+	free(to_writer);
+	stats_flush();
+	return records_read;
+}
+
+/* adds path to the paths of an option given several times */
+static void add_path(const char ***paths, int *n, const char *path)
+{
+	if ((*paths = realloc(*paths, (*n + 1) * sizeof(char *)))==NULL)
+		err(1,"realloc failed");
+	(*paths)[(*n)++] = path;
+}
+
+/*
+   Returns template with every {name} replaced by the name of the input
+   file path: its base name without a .gz or .bgz suffix and without its
+   extension (sample.fa.gz is sample).
+ */
+static char *expand_name(const char *template, const char *path)
+{
+	const char *name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path, *p;
+	size_t len = strlen(name), size;
+	char *s;
+	FILE *f;
+
+	if (len > 3 && strcmp(name + len - 3, ".gz")==0)
+		len -= 3;
+	else if (len > 4 && strcmp(name + len - 4, ".bgz")==0)
+		len -= 4;
+	for (p = name + len - 1; p > name && *p != '.'; p--)
+		;
+	if (p > name)
+		len = p - name;
+
+	if ((f = open_memstream(&s, &size))==NULL)
+		err(1,"open_memstream failed");
+	while ((p = strstr(template, "{name}")) != NULL) {
+		fwrite(template, 1, p - template, f);
+		fwrite(name, 1, len, f);
+		template = p + strlen("{name}");
+	}
+	fputs(template, f);
+	fclose(f);
+	return s;
+}
+
+static int compare_paths(const void *a, const void *b)
+{
+	return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+/*
+   The path of a file of each input for an option: given once per input,
+   or once as a template with {name} (see expand_name()). NULL for every
+   input if the option is not given.
+ */
+static char **per_input_paths(const char **paths, int n, const char *option)
+{
+	char **p, **sorted;
+	int i;
+
+	if ((p = calloc(n_inputs, sizeof(char *)))==NULL)
+		err(1,"calloc failed");
+	if (n == 0)
+		return p;
+	if (n == 1 && strstr(paths[0], "{name}")) {
+		if (input_paths == NULL) {
+			fprintf(stderr,"Error: {name} in %s needs input files.\n", option);
+			exit(1);
+		}
+		for (i = 0; i < n_inputs; i++)
+			p[i] = expand_name(paths[0], input_paths[i]);
+	} else if (n == n_inputs) {
+		for (i = 0; i < n_inputs; i++)
+			p[i] = (char *) paths[i];
+	} else {
+		fprintf(stderr,"Error: %s must be given once for each input file, or contain {name}.\n", option);
+		exit(1);
+	}
+
+	//two inputs written to the same file would overwrite each other
+	if ((sorted = malloc(n_inputs * sizeof(char *)))==NULL)
+		err(1,"malloc failed");
+	memcpy(sorted, p, n_inputs * sizeof(char *));
+	qsort(sorted, n_inputs, sizeof(char *), compare_paths);
+	for (i = 1; i < n_inputs; i++)
+		if (strcmp(sorted[i - 1], sorted[i])==0) {
+			fprintf(stderr,"Error: several inputs would be written to '%s' (%s).\n", sorted[i], option);
+			exit(1);
+		}
+	free(sorted);
+	return p;
+}
+
 int main(int argc, char **argv)
 {
-	char *s = NULL, *t;
-	int n = 1, k = 2, b = 0;
-	struct rusage r1, r2;
-	struct timeval t1, t2;
+	int n = 1, k = 2;
 	struct timeval tv;
-	double u1;
 	unsigned long seed;
-	int i, l;
+	int i;
 	int c;
-	unsigned long line=1;
+	unsigned long records;
 	bool show_original=false;
 	int max_retries=10;
-
-	char*	fasta_id;
-	char*	fasta_sequence;
-
-	if ((fasta_id = malloc(MAX_ID_SIZE))==NULL)
-		err(1,"malloc(%d) failed", MAX_ID_SIZE);
-	if ((fasta_sequence = malloc(MAX_SEQUENCE_SIZE))==NULL)
-		err(1,"malloc(%d) failed", MAX_SEQUENCE_SIZE);
+	size_t max_memory=0;
+	const char *tmpdir=NULL;
+	const char *stats_file=NULL;
+	const char *trace_file=NULL;
+	const char *failures_path=NULL;
+	const char **outputs=NULL, **gzis=NULL, **indexes=NULL;
+	int n_outputs=0, n_gzis=0, n_indexes=0;
+	long input_size=0;
+	struct stat st;
+	int progress_interval=0;
+	double start;
 
 	gettimeofday(&tv, NULL);
 	seed = (unsigned long) tv.tv_sec;
 
 	// Parse command line options
-	while ( (c=getopt(argc, argv, "ok:n:s:hr:"))!=-1) {
+	while ( (c=getopt_long(argc, argv, "ok:n:s:hr:pt:z", long_options, NULL))!=-1) {
 		switch (c)
 		{
 		case 'o':
 			show_original = true;
 			break;
 
+		case 'p':
+			use_packed_engine = true;
+			break;
+
+		case 'z':
+			bgzf_output = true;
+			break;
+
+		case OPT_GZI:
+			add_path(&gzis, &n_gzis, optarg);
+			break;
+
+		case OPT_FORMAT:
+			if (strcmp(optarg,"packed")==0)
+				packed_output = use_packed_engine = true;
+			else if (strcmp(optarg,"fasta")!=0) {
+				fprintf(stderr,"Error: invalid --format value (%s). Must be fasta or packed.", optarg);
+				exit(1);
+			}
+			break;
+
+		case 't':
+			n_threads = atoi(optarg);
+			if (n_threads<=0) {
+				fprintf(stderr,"Error: invalid -t value (%s). Must be a number larger than zero.", optarg);
+				exit(1);
+			}
+			break;
+
 		case 'n':
 			n = atoi(optarg);
 			if (n<=0) {
@@ -340,6 +1891,79 @@ int main(int argc, char **argv)
 			seed = atoi(optarg);
 			break;
 
+		case OPT_MAX_MEMORY:
+			max_memory = units_size(optarg);
+			if (max_memory==0) {
+				fprintf(stderr,"Error: invalid --max-memory value (%s). Must be a size such as 512M or 16G.", optarg);
+				exit(1);
+			}
+			break;
+
+		case OPT_TMPDIR:
+			tmpdir = optarg;
+			break;
+
+		case OPT_STATS:
+			stats_file = optarg;
+			break;
+
+		case OPT_FAILURES:
+			failures_path = optarg;
+			break;
+
+		case OPT_TRACE:
+			trace_file = optarg;
+			break;
+
+		case OPT_REGIONS:
+			regions_path = optarg;
+			break;
+
+		case OPT_FAI:
+			fai_path = optarg;
+			break;
+
+		case OPT_INDEX:
+			add_path(&indexes, &n_indexes, optarg);
+			break;
+
+		case OPT_WRAP:
+			wrap_width = atol(optarg);
+			if (wrap_width<=0) {
+				fprintf(stderr,"Error: invalid --wrap value (%s). Must be a number larger than zero.", optarg);
+				exit(1);
+			}
+			break;
+
+		case OPT_OUTPUT:
+			add_path(&outputs, &n_outputs, optarg);
+			break;
+
+		case OPT_IO_URING:
+			use_io_uring = true;
+			break;
+
+		case OPT_PROGRESS:
+			progress_interval = atoi(optarg);
+			if (progress_interval<=0) {
+				fprintf(stderr,"Error: invalid --progress value (%s). Must be a number of seconds larger than zero.", optarg);
+				exit(1);
+			}
+			break;
+
+		case OPT_HUGEPAGES:
+			if (optarg==NULL || strcmp(optarg,"thp")==0)
+				umem_set_hugepages(UMEM_HUGE_THP);
+			else if (strcmp(optarg,"hugetlb")==0)
+				umem_set_hugepages(UMEM_HUGE_HUGETLB);
+			else if (strcmp(optarg,"off")==0)
+				umem_set_hugepages(UMEM_HUGE_OFF);
+			else {
+				fprintf(stderr,"Error: invalid --hugepages value (%s). Must be thp, hugetlb or off.", optarg);
+				exit(1);
+			}
+			break;
+
 		default:
 		case 'h':
 			showhelp();
@@ -348,24 +1972,107 @@ int main(int argc, char **argv)
 
 	srandom(seed);
 	set_randfunc((randfunc_t) random);
+	umem_set_limit(max_memory, tmpdir);
+	if (stats_file)
+		stats_init(max_retries);
+	if (trace_file)
+		trace_init();
+	if (n_gzis && !bgzf_output) {
+		fprintf(stderr,"Error: --gzi needs -z.\n");
+		exit(1);
+	}
+	if (packed_output && (n_indexes || wrap_width)) {
+		fprintf(stderr,"Error: --index and --wrap need FASTA output.\n");
+		exit(1);
+	}
+	if (fai_path && !regions_path) {
+		fprintf(stderr,"Error: --fai needs --regions.\n");
+		exit(1);
+	}
 
-	while (read_fasta_record(fasta_id,MAX_ID_SIZE, fasta_sequence, MAX_SEQUENCE_SIZE, line)) {
-		line+=2;
+	if (optind < argc) {
+		input_paths = argv + optind;
+		n_inputs = argc - optind;
+	}
+	if (failures_path) {
+		if ((failures_file = fopen(failures_path, "w"))==NULL)
+			err(1,"can't create failures file '%s'", failures_path);
+		fprintf(failures_file, "%sid\tlength\tretries\treason\tdistinct_shuffles\n",
+			n_inputs > 1 ? "input\t" : "");
+	}
+	if (n_inputs > 1 && n_outputs == 0) {
+		fprintf(stderr,"Error: several input files need --output.\n");
+		exit(1);
+	}
+	if (n_inputs > 1 && fai_path) {
+		fprintf(stderr,"Error: --fai takes a single input file (the index of each input is its name plus .fai).\n");
+		exit(1);
+	}
+	output_paths = per_input_paths(outputs, n_outputs, "--output");
+	gzi_paths = per_input_paths(gzis, n_gzis, "--gzi");
+	index_paths = per_input_paths(indexes, n_indexes, "--index");
+	index_output = n_indexes > 0;
+	if (input_paths) {
+		open_input_file(0);
+		for (i = 0; i < n_inputs && n_inputs > 1; i++)
+			if (stat(input_paths[i], &st)==0)
+				input_size += st.st_size;
+		if (n_inputs > 1)
+			progress_set_input_size(input_size);
+	}
 
-		if (show_original) {
-			printf("%s-unshuffled\n", fasta_id);
-			printf("%s\n", fasta_sequence);
-		}
+	//compressed blocks and packed records can't be placed before they are made,
+	//and the outputs of several inputs are written in turn
+	if (output_paths[0] && n_inputs == 1 && !bgzf_output && !packed_output) {
+		if ((output_fd = open(output_paths[0], O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0)
+			err(1,"can't create output file '%s'", output_paths[0]);
+		//the output is about as large as the input times the copies of every record
+		if (!regions_path && fstat(STDIN_FILENO, &st)==0 && S_ISREG(st.st_mode))
+			reserve_output(st.st_size * (n + show_original));
+	}
+	start_output(0);
+	progress_start(progress_interval);
 
-		if (n>1) {
-			print_shuffle_sequence_perm(k, n, fasta_id, fasta_sequence);
-		} else {
-			print_shuffle_sequence_retries(k, max_retries, fasta_id, fasta_sequence);
-		}
+	opts.k = k;
+	opts.n = n;
+	opts.max_retries = max_retries;
+	opts.show_original = show_original;
+	shuffle_seed = seed;
+	records = shuffle_all();
+	progress_stop();
+
+	if (output_fd >= 0) {
+		if (ftruncate(output_fd, output_size)!=0)
+			err(1,"can't write output file '%s'", output_paths[0]);
+		//give back the space reserved past the end
+		if (output_reserved > output_size)
+			fallocate(output_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+				output_size, output_reserved - output_size);
+		if (close(output_fd)!=0)
+			err(1,"can't write output file '%s'", output_paths[0]);
 	}
 
-	free(fasta_id);
-	free(fasta_sequence);
+	if (failures_file && fclose(failures_file)!=0)
+		err(1,"can't write failures file '%s'", failures_path);
+	if (failed_records)
+		fprintf(stderr,"WARNING: failed to find new shuffle for %lu of %lu sequences after %d retries, they were written unshuffled%s%s%s\n",
+			failed_records, records, max_retries,
+			failures_path ? " (listed in " : " (use --failures=FILE to list them)",
+			failures_path ? failures_path : "", failures_path ? ")" : "");
 
-	return 0;
+	if (trace_file) {
+		fflush(stdout);
+		if (!trace_write(trace_file))
+			err(1,"can't write trace file '%s'", trace_file);
+	}
+
+	if (stats_file) {
+		start = stats_clock();
+		fflush(stdout);
+		stats_add_time(PHASE_OUTPUT, start);
+		if (!stats_write(stats_file))
+			err(1,"can't write stats file '%s'", stats_file);
+	}
+
+	return read_failed ? 1 : 0;	//the input error was reported by the reader
 }
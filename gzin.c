@@ -0,0 +1,309 @@
+/*
+   gzin - compressed input of fasta_ushuffle.
+
+   Released under the same license as uShuffle (see README).
+ */
+
+/*
+ *	gzin.c - transparent gzip and BGZF decompression
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <zlib.h>
+#include "gzin.h"
+#include "workq.h"
+#include "ring.h"
+
+#define GZIP_CHUNK	(1L << 20)	/* compressed bytes read at a time */
+#define BGZF_JOB	(256L << 10)	/* compressed bytes of whole blocks per job */
+#define BGZF_MAX_BLOCK	(64L << 10)
+
+/* a run of whole BGZF blocks, inflated by one thread */
+typedef struct bgzf_job {
+	gzin *z;
+	unsigned char *raw;
+	size_t raw_len;
+	off_t raw_offset;	/* of the first block in the input */
+	unsigned char *out;
+	size_t out_len, out_pos;
+	int done;		/* set atomically by the inflating thread */
+} bgzf_job;
+
+struct gzin {
+	int format;
+	gzin_source source;
+	int source_eof;
+	off_t source_read;	/* compressed bytes read */
+
+	/* gzip */
+	z_stream stream;
+	unsigned char *in;
+	int stream_end;
+
+	/* BGZF: a window of jobs, consumed in order from head */
+	workq *pool;
+	int n_threads;
+	z_stream *streams;	/* one per thread */
+	bgzf_job **jobs;
+	off_t submitted;	/* compressed bytes of the jobs submitted */
+	int window, head, n_jobs;
+	unsigned char *carry;	/* start of a block read with the previous job */
+	size_t carry_len;
+};
+
+int gzin_format(const unsigned char *head, size_t n)
+{
+	if (n < 3 || head[0] != 0x1f || head[1] != 0x8b || head[2] != 8)
+		return GZIN_NONE;
+	/* FEXTRA with a BC subfield of 2 bytes first */
+	if (n >= 18 && (head[3] & 4) && head[10] + 256 * head[11] >= 6
+	    && head[12] == 'B' && head[13] == 'C' && head[14] == 2 && head[15] == 0)
+		return GZIN_BGZF;
+	return GZIN_GZIP;
+}
+
+/* fills buf with up to len bytes of the source, short only at its end */
+static size_t read_fully(gzin *z, unsigned char *buf, size_t len)
+{
+	size_t got = 0;
+	ssize_t n;
+
+	while (got < len && !z->source_eof) {
+		if ((n = z->source(buf + got, len - got)) < 0)
+			err(1,"read failed");
+		if (n == 0)
+			z->source_eof = 1;
+		got += n;
+		z->source_read += n;
+	}
+	return got;
+}
+
+static unsigned get16(const unsigned char *p)
+{
+	return p[0] | p[1] << 8;
+}
+
+static unsigned long get32(const unsigned char *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (unsigned long) p[3] << 24;
+}
+
+/* size of the BGZF block at p, 0 if it is not one */
+static size_t bgzf_block_size(const unsigned char *p, size_t n)
+{
+	size_t xlen, i;
+
+	if (n < 18 || p[0] != 0x1f || p[1] != 0x8b || p[2] != 8 || !(p[3] & 4))
+		return 0;
+	xlen = get16(p + 10);
+	for (i = 12; i + 4 <= 12 + xlen && i + 4 <= n; i += 4 + get16(p + i + 2))
+		if (p[i] == 'B' && p[i + 1] == 'C' && get16(p + i + 2) == 2)
+			return i + 6 <= n ? get16(p + i + 4) + 1 : 0;
+	return 0;
+}
+
+static void bgzf_inflate(void *arg, int worker)
+{
+	bgzf_job *job = arg;
+	z_stream *s = &job->z->streams[worker];
+	size_t pos = 0, size, out = 0, xlen, isize;
+
+	while (pos < job->raw_len) {
+		size = bgzf_block_size(job->raw + pos, job->raw_len - pos);
+		xlen = get16(job->raw + pos + 10);
+		isize = get32(job->raw + pos + size - 4);
+		if (inflateReset(s) != Z_OK)
+			errx(1,"inflateReset failed");
+		s->next_in = job->raw + pos + 12 + xlen;
+		s->avail_in = size - 12 - xlen - 8;
+		s->next_out = job->out + out;
+		s->avail_out = isize;
+		if (inflate(s, Z_FINISH) != Z_STREAM_END || s->avail_out != 0
+		    || crc32(0, job->out + out, isize) != get32(job->raw + pos + size - 8))
+			errx(1,"corrupt BGZF block in the input");
+		pos += size;
+		out += isize;
+	}
+	free(job->raw);
+	job->raw = NULL;
+	__atomic_store_n(&job->done, 1, __ATOMIC_RELEASE);
+}
+
+/* reads the blocks of the next job, and hands it to the pool; 0 at the end of the input */
+static int bgzf_submit(gzin *z)
+{
+	bgzf_job *job;
+	size_t pos, size;
+
+	if (z->source_eof && z->carry_len == 0)
+		return 0;
+	if ((job = calloc(1, sizeof(bgzf_job))) == NULL
+	    || (job->raw = malloc(BGZF_JOB + BGZF_MAX_BLOCK)) == NULL)
+		err(1,"malloc failed");
+	job->z = z;
+	memcpy(job->raw, z->carry, z->carry_len);
+	job->raw_len = z->carry_len + read_fully(z, job->raw + z->carry_len, BGZF_JOB - z->carry_len);
+
+	/* the job ends with the last whole block; the rest starts the next one */
+	for (pos = 0; pos < job->raw_len; pos += size) {
+		if ((size = bgzf_block_size(job->raw + pos, job->raw_len - pos)) == 0 && job->raw_len - pos >= 18)
+			errx(1,"the input is not valid BGZF (a block doesn't start at byte offset %zu of a job)", pos);
+		if (size == 0 || pos + size > job->raw_len)
+			break;
+		if (12 + get16(job->raw + pos + 10) + 8 > size)
+			errx(1,"the input is not valid BGZF (block too short)");
+		if (get32(job->raw + pos + size - 4) > BGZF_MAX_BLOCK)
+			errx(1,"the input is not valid BGZF (block too large)");
+		job->out_len += get32(job->raw + pos + size - 4);
+	}
+	if (pos < job->raw_len && z->source_eof)
+		errx(1,"the input ends within a BGZF block");
+	z->carry_len = job->raw_len - pos;
+	memcpy(z->carry, job->raw + pos, z->carry_len);
+	job->raw_len = pos;
+	job->raw_offset = z->submitted;
+	z->submitted += pos;
+
+	if ((job->out = malloc(job->out_len ? job->out_len : 1)) == NULL)
+		err(1,"malloc failed");
+	z->jobs[(z->head + z->n_jobs++) % z->window] = job;
+	workq_submit(z->pool, job);
+	return 1;
+}
+
+static ssize_t bgzf_read(gzin *z, void *buf, size_t len)
+{
+	bgzf_job *job;
+	unsigned spins = 0;
+	size_t n;
+
+	for (;;) {
+		while (z->n_jobs < z->window && bgzf_submit(z))
+			;
+		if (z->n_jobs == 0)
+			return 0;
+		job = z->jobs[z->head];
+		while (!__atomic_load_n(&job->done, __ATOMIC_ACQUIRE))
+			backoff(&spins);
+		if (job->out_pos < job->out_len)
+			break;
+		/* used up (or empty, like the end-of-file block) */
+		free(job->out);
+		free(job);
+		z->head = (z->head + 1) % z->window;
+		z->n_jobs--;
+	}
+	n = job->out_len - job->out_pos < len ? job->out_len - job->out_pos : len;
+	memcpy(buf, job->out + job->out_pos, n);
+	job->out_pos += n;
+	return n;
+}
+
+static ssize_t gzip_read(gzin *z, void *buf, size_t len)
+{
+	int rc;
+
+	z->stream.next_out = buf;
+	z->stream.avail_out = len;
+	while (z->stream.avail_out == len && !z->stream_end) {
+		if (z->stream.avail_in == 0) {
+			z->stream.next_in = z->in;
+			z->stream.avail_in = read_fully(z, z->in, GZIP_CHUNK);
+			if (z->stream.avail_in == 0)
+				errx(1,"the gzip input is truncated");
+		}
+		rc = inflate(&z->stream, Z_NO_FLUSH);
+		if (rc == Z_STREAM_END) {
+			/* another member may follow; anything else ends the input */
+			if (z->stream.avail_in == 0 && !z->source_eof) {
+				z->stream.next_in = z->in;
+				z->stream.avail_in = read_fully(z, z->in, GZIP_CHUNK);
+			}
+			if (z->stream.avail_in >= 2 && z->stream.next_in[0] == 0x1f && z->stream.next_in[1] == 0x8b)
+				inflateReset(&z->stream);
+			else {
+				if (z->stream.avail_in > 0)
+					warnx("trailing garbage after the gzip input ignored");
+				z->stream_end = 1;
+			}
+		} else if (rc != Z_OK && rc != Z_BUF_ERROR)
+			errx(1,"corrupt gzip input: %s", z->stream.msg ? z->stream.msg : zError(rc));
+	}
+	return len - z->stream.avail_out;
+}
+
+gzin *gzin_open(gzin_source source, int format, int n_threads)
+{
+	gzin *z;
+	int i;
+
+	if ((z = calloc(1, sizeof(gzin))) == NULL)
+		err(1,"calloc failed");
+	z->format = format;
+	z->source = source;
+	if (format == GZIN_GZIP) {
+		if ((z->in = malloc(GZIP_CHUNK)) == NULL)
+			err(1,"malloc failed");
+		if (inflateInit2(&z->stream, 15 + 16) != Z_OK)
+			errx(1,"inflateInit2 failed");
+		return z;
+	}
+
+	z->n_threads = n_threads;
+	z->window = 2 * n_threads + 2;
+	if ((z->jobs = calloc(z->window, sizeof(bgzf_job *))) == NULL
+	    || (z->streams = calloc(n_threads, sizeof(z_stream))) == NULL
+	    || (z->carry = malloc(BGZF_JOB + BGZF_MAX_BLOCK)) == NULL)
+		err(1,"calloc failed");
+	for (i = 0; i < n_threads; i++)
+		if (inflateInit2(&z->streams[i], -15) != Z_OK)
+			errx(1,"inflateInit2 failed");
+	z->pool = workq_create(n_threads, z->window, bgzf_inflate);
+	return z;
+}
+
+ssize_t gzin_read(gzin *z, void *buf, size_t len)
+{
+	if (len == 0)
+		return 0;
+	return z->format == GZIN_BGZF ? bgzf_read(z, buf, len) : gzip_read(z, buf, len);
+}
+
+off_t gzin_offset(gzin *z)
+{
+	bgzf_job *job;
+
+	if (z->format == GZIN_GZIP)
+		return z->source_read - z->stream.avail_in;
+	if (z->n_jobs == 0)
+		return z->submitted;
+	/* within the job being read, in proportion of its output */
+	job = z->jobs[z->head];
+	return job->raw_offset + (job->out_len ? (off_t) job->raw_len * job->out_pos / job->out_len : 0);
+}
+
+void gzin_close(gzin *z)
+{
+	int i;
+
+	if (z->format == GZIN_GZIP) {
+		inflateEnd(&z->stream);
+		free(z->in);
+		free(z);
+		return;
+	}
+	workq_finish(z->pool);
+	for (i = 0; i < z->n_jobs; i++) {
+		free(z->jobs[(z->head + i) % z->window]->raw);
+		free(z->jobs[(z->head + i) % z->window]->out);
+		free(z->jobs[(z->head + i) % z->window]);
+	}
+	for (i = 0; i < z->n_threads; i++)
+		inflateEnd(&z->streams[i]);
+	free(z->streams);
+	free(z->jobs);
+	free(z->carry);
+	free(z);
+}
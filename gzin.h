@@ -0,0 +1,49 @@
+/*
+   gzin - compressed input of fasta_ushuffle.
+
+   Released under the same license as uShuffle (see README).
+ */
+
+/*
+ *	gzin.h - transparent gzip and BGZF decompression
+ *
+ *	The format is told by the magic bytes at the start of the input.
+ *	Plain gzip (including concatenated members) is inflated as a stream,
+ *	straight into the caller's buffer. BGZF, the blocked gzip of htslib
+ *	and bgzip, is cut into jobs of whole blocks that a pool of threads
+ *	inflates in parallel, while the caller consumes the finished jobs in
+ *	order.
+ */
+#ifndef GZIN_H
+#define GZIN_H
+
+#include <sys/types.h>
+
+enum { GZIN_NONE, GZIN_GZIP, GZIN_BGZF };
+
+/* bytes of the start of the input that gzin_format() needs */
+#define GZIN_MAGIC_BYTES 18
+
+/* format of an input starting with the n bytes of head */
+int gzin_format(const unsigned char *head, size_t n);
+
+/* reads the compressed input, like read(2) */
+typedef ssize_t (*gzin_source)(void *buf, size_t len);
+
+typedef struct gzin gzin;
+
+/* decodes source, in n_threads threads for BGZF */
+gzin *gzin_open(gzin_source source, int format, int n_threads);
+
+/*
+   Like read(2): up to len bytes of the decompressed input, 0 at its end.
+   Exits on corrupt input.
+ */
+ssize_t gzin_read(gzin *z, void *buf, size_t len);
+
+/* compressed bytes of the input behind the bytes read so far (within a BGZF job, an estimate) */
+off_t gzin_offset(gzin *z);
+
+void gzin_close(gzin *z);
+
+#endif
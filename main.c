@@ -37,6 +37,8 @@
 #include <sys/resource.h>
 #include <sys/time.h>
 #include "ushuffle.h"
+#include "umem.h"
+#include "bench.h"
 
 void print_help_and_exit() {
 	printf("uShuffle: a useful tool for shuffling biological sequences while preserving the k-let counts\n");
@@ -45,19 +47,28 @@ void print_help_and_exit() {
 			"  -n <number>     specifies the number of random sequences to generate\n"
 			"  -k <number>     specifies the let size\n"
 			"  -seed <number>  specifies the seed for random number generator\n"
-			"  -b              benchmark\n");
+			"  -wide           use 64-bit graph positions even for short sequences\n"
+			"  -m              print the memory accounting of shuffle1 to stderr\n"
+			"  -hugepages      back large graph arrays with transparent huge pages\n"
+			"  -b              benchmark: print shuffle1 and shuffle2 timings as JSON lines\n"
+			"Benchmark options (with -b, instead of -s):\n"
+			"  -f <file>       benchmark the sequence of a FASTA or plain text file\n"
+			"  -A <list>       alphabets of synthetic sequences (default ACGT)\n"
+			"  -L <list>       lengths, e.g. 1k,1M,1G (default 1k,10k,100k,1M)\n"
+			"  -K <list>       let sizes (default -k, or 1,2,3,4,6,8,12,16,24,32)\n"
+			"  lists are comma separated; -n sets the shuffle2 calls per run\n");
 	exit(0); 
 }
 
 int main(int argc, char **argv) {
 	char *s = NULL, *t;
-	int n = 1, k = 2, b = 0;
-	struct rusage r1, r2;
-	struct timeval t1, t2;
+	int n = 1, k = 2, b = 0, m = 0;
+	shuffle_mem mem;
+	bench_opts bo = { NULL, NULL, NULL, NULL, "ACGT", 1, 0 };
 	struct timeval tv;
-	double u1;
 	unsigned long seed;
-	int i, l;
+	int i;
+	long l;
 
 	gettimeofday(&tv, NULL);
 	seed = (unsigned long) tv.tv_sec;
@@ -75,7 +86,7 @@ int main(int argc, char **argv) {
 				print_help_and_exit();
 		} else if (!strcmp(argv[i], "-k")) {
 			if (i + 1 < argc && argv[i + 1][0] != '-')
-				k = atoi(argv[++i]);
+				bo.ks = argv[++i];
 			else
 				print_help_and_exit();
 		} else if (!strcmp(argv[i], "-seed")) {
@@ -83,9 +94,40 @@ int main(int argc, char **argv) {
 				seed = atoi(argv[++i]);
 			else
 				print_help_and_exit();
+		} else if (!strcmp(argv[i], "-f") || !strcmp(argv[i], "-A")
+				|| !strcmp(argv[i], "-L") || !strcmp(argv[i], "-K")) {
+			if (i + 1 >= argc || argv[i + 1][0] == '-')
+				print_help_and_exit();
+			switch (argv[i++][1]) {
+			case 'f': bo.file = argv[i]; break;
+			case 'A': bo.alphabets = argv[i]; break;
+			case 'L': bo.lengths = argv[i]; break;
+			case 'K': bo.ks = argv[i]; break;
+			}
 		} else if (!strcmp(argv[i], "-b"))
 			b = 1;
-	if (n <= 0 || s == NULL)
+		else if (!strcmp(argv[i], "-wide"))
+			set_shuffle_width(64);
+		else if (!strcmp(argv[i], "-m"))
+			m = 1;
+		else if (!strcmp(argv[i], "-hugepages"))
+			umem_set_hugepages(UMEM_HUGE_THP);
+	if (bo.ks && strchr(bo.ks, ',') == NULL)	/* a single -k or -K value */
+		k = atoi(bo.ks);
+	if (b) {
+		if (n <= 0)
+			print_help_and_exit();
+		bo.sequence = s;
+		bo.n = n;
+		bo.seed = seed;
+		if (!bo.ks)
+			bo.ks = "1,2,3,4,6,8,12,16,24,32";
+		if (!bo.lengths && !s && !bo.file)
+			bo.lengths = "1k,10k,100k,1M";
+		benchmark(&bo);
+		return 0;
+	}
+	if (n <= 0 || s == NULL || strchr(bo.ks ? bo.ks : "", ','))
 		print_help_and_exit();
 
 	l = strlen(s);
@@ -96,20 +138,21 @@ int main(int argc, char **argv) {
 	t[l] = '\0';
 	srandom(seed);
 	set_randfunc((randfunc_t) random);
-	if (b)
-		getrusage(RUSAGE_SELF, &r1);
 	shuffle1(s, l, k);
+	if (m) {
+		shuffle_memstats(&mem);
+		fprintf(stderr, "length\t%ld\n", l);
+		fprintf(stderr, "k\t%d\n", k);
+		fprintf(stderr, "index_bits\t%d\n", shuffle_width());
+		fprintf(stderr, "vertices\t%ld\n", mem.n_vertices);
+		fprintf(stderr, "peak_bytes\t%lu\n", mem.peak);
+		fprintf(stderr, "peak_bytes_per_base\t%.2f\n", (double) mem.peak / l);
+		fprintf(stderr, "graph_bytes\t%lu\n", mem.graph);
+		fprintf(stderr, "hugepage_bytes\t%lu\n", mem.huge);
+	}
 	for (i = 0; i < n; i++) {
 		shuffle2(t);
-		if (!b)
-			printf("%s\n", t);
-	}
-	if (b) {
-		getrusage(RUSAGE_SELF, &r2);
-		t1 = r1.ru_utime;
-		t2 = r2.ru_utime;
-		u1 = (t2.tv_sec - t1.tv_sec) * 1000 + (t2.tv_usec - t1.tv_usec) * 0.001;
-		printf("%g\n", u1);				/* time in msec */
+		printf("%s\n", t);
 	}
 	return 0;
 }
@@ -0,0 +1,322 @@
+/*
+   packdna - 2-bit packed nucleotide sequences for uShuffle.
+
+   Released under the same license as uShuffle (see README).
+ */
+
+/*
+ *	packdna.c - packing, unpacking and shuffling of 2-bit DNA
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <pthread.h>
+#include "packdna.h"
+#include "ushuffle.h"
+#include "umem.h"
+
+const char packdna_base[4] = { 'T', 'C', 'A', 'G' };
+
+int packdna_code(char c)
+{
+	switch (c) {
+	case 'T': case 't':
+		return 0;
+	case 'C': case 'c':
+		return 1;
+	case 'A': case 'a':
+		return 2;
+	case 'G': case 'g':
+		return 3;
+	default:
+		return -1;
+	}
+}
+
+void packdna_init(packed_dna *p)
+{
+	memset(p, 0, sizeof(*p));
+}
+
+void packdna_free(packed_dna *p)
+{
+	if (p->bits)
+		umem_free(p->bits, PACKDNA_BYTES(p->length) + 1);
+	free(p->runs);
+	free(p->masks);
+	packdna_init(p);
+}
+
+static void add_run(packed_run **runs, long *n, long *alloc, long start, char base)
+{
+	packed_run *r;
+
+	if (*n > 0) {
+		r = &(*runs)[*n - 1];
+		if (r->start + r->length == start && r->base == base) {
+			r->length++;
+			return;
+		}
+	}
+	if (*n == *alloc) {
+		*alloc = *alloc ? *alloc * 2 : 16;
+		if ((*runs = realloc(*runs, *alloc * sizeof(packed_run))) == NULL)
+			err(1,"realloc failed");
+	}
+	r = &(*runs)[(*n)++];
+	r->start = start;
+	r->length = 1;
+	r->base = base;
+}
+
+void packdna_pack(packed_dna *p, const char *s, long l)
+{
+	long i, runs_alloc = 0, masks_alloc = 0;
+	int code;
+
+	packdna_free(p);
+	p->bits = umem_alloc(PACKDNA_BYTES(l) + 1);
+	p->length = l;
+
+	for (i = 0; i < l; i++) {
+		code = packdna_code(s[i]);
+		if (code < 0) {
+			add_run(&p->runs, &p->n_runs, &runs_alloc, i, s[i]);
+			continue;
+		}
+		packdna_set(p->bits, i, code);
+		if (s[i] >= 'a')
+			add_run(&p->masks, &p->n_masks, &masks_alloc, i, 'n');
+	}
+}
+
+/* the four bases of every byte of packed bits */
+static char unpack_table[256][4];
+static pthread_once_t unpack_table_once = PTHREAD_ONCE_INIT;
+
+static void init_unpack_table()
+{
+	int b, i;
+
+	for (b = 0; b < 256; b++)
+		for (i = 0; i < 4; i++)
+			unpack_table[b][i] = packdna_base[(b >> (6 - 2 * i)) & 3];
+}
+
+/* first of the n sorted runs that ends after start */
+static long first_run_after(const packed_run *runs, long n, long start)
+{
+	long lo = 0, hi = n, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (runs[mid].start + runs[mid].length <= start)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+void packdna_unpack_range(const packed_dna *p, long start, long len, char *t)
+{
+	long i, j, from, to, end = start + len;
+
+	pthread_once(&unpack_table_once, init_unpack_table);
+	/* a byte of bits at a time, after the bases before the first whole byte */
+	for (i = start; i < end && (i & 3); i++)
+		t[i - start] = packdna_base[packdna_get(p->bits, i)];
+	for (; i + 4 <= end; i += 4)
+		memcpy(t + i - start, unpack_table[p->bits[i >> 2]], 4);
+	for (; i < end; i++)
+		t[i - start] = packdna_base[packdna_get(p->bits, i)];
+
+	for (i = first_run_after(p->masks, p->n_masks, start); i < p->n_masks && p->masks[i].start < end; i++) {
+		from = p->masks[i].start > start ? p->masks[i].start : start;
+		to = p->masks[i].start + p->masks[i].length < end ? p->masks[i].start + p->masks[i].length : end;
+		for (j = from; j < to; j++)
+			t[j - start] += 'a' - 'A';
+	}
+	for (i = first_run_after(p->runs, p->n_runs, start); i < p->n_runs && p->runs[i].start < end; i++) {
+		from = p->runs[i].start > start ? p->runs[i].start : start;
+		to = p->runs[i].start + p->runs[i].length < end ? p->runs[i].start + p->runs[i].length : end;
+		memset(t + from - start, p->runs[i].base, to - from);
+	}
+}
+
+void packdna_unpack(const packed_dna *p, char *t)
+{
+	packdna_unpack_range(p, 0, p->length, t);
+}
+
+int packdna_compare(const packed_dna *p, const char *t)
+{
+	char chunk[65536];
+	long i, n;
+	int c;
+
+	for (i = 0; i < p->length; i += n) {
+		n = p->length - i < (long) sizeof(chunk) ? p->length - i : (long) sizeof(chunk);
+		packdna_unpack_range(p, i, n, chunk);
+		if ((c = memcmp(chunk, t + i, n)) != 0)
+			return c;
+	}
+	return 0;
+}
+
+static packed_run *copy_runs(const packed_run *runs, long n)
+{
+	packed_run *copy;
+
+	if (n == 0)
+		return NULL;
+	if ((copy = malloc(n * sizeof(packed_run))) == NULL)
+		err(1,"malloc failed");
+	return memcpy(copy, runs, n * sizeof(packed_run));
+}
+
+/* the ACGT stretch of s, if it has exactly one: its start and end */
+static int one_stretch(const packed_dna *s, long *start, long *end)
+{
+	long i, from = 0, to, n = 0;
+
+	for (i = 0; i <= s->n_runs && n <= 1; i++) {
+		to = (i < s->n_runs) ? s->runs[i].start : s->length;
+		if (to > from) {
+			*start = from;
+			*end = to;
+			n++;
+		}
+		if (i < s->n_runs)
+			from = s->runs[i].start + s->runs[i].length;
+	}
+	return n == 1;
+}
+
+void shuffle1_packed_dna(const packed_dna *s, int k)
+{
+	long start, end;
+
+	if (one_stretch(s, &start, &end))
+		shuffle1_packed(s->bits, start, end - start, k);
+}
+
+void shuffle2_packed_dna(const packed_dna *s, packed_dna *t, int k)
+{
+	long i, start, end;
+	int one = one_stretch(s, &start, &end);
+
+	packdna_free(t);
+	t->bits = umem_alloc(PACKDNA_BYTES(s->length) + 1);
+	t->length = s->length;
+	t->runs = copy_runs(s->runs, s->n_runs);
+	t->n_runs = s->n_runs;
+	t->masks = copy_runs(s->masks, s->n_masks);
+	t->n_masks = s->n_masks;
+
+	if (one) {	/* the graph of shuffle1_packed_dna() */
+		shuffle2_packed(t->bits, start);
+		return;
+	}
+
+	/* shuffle each ACGT stretch between two runs on its own */
+	start = 0;
+	for (i = 0; i <= s->n_runs; i++) {
+		end = (i < s->n_runs) ? s->runs[i].start : s->length;
+		if (end > start) {
+			shuffle1_packed(s->bits, start, end - start, k);
+			shuffle2_packed(t->bits, start);
+		}
+		if (i < s->n_runs)
+			start = s->runs[i].start + s->runs[i].length;
+	}
+}
+
+void shuffle_packed(const packed_dna *s, packed_dna *t, int k)
+{
+	shuffle1_packed_dna(s, k);
+	shuffle2_packed_dna(s, t, k);
+}
+
+int packdna_equal(const packed_dna *a, const packed_dna *b)
+{
+	long i, start = 0, end, j;
+
+	if (a->length != b->length)
+		return 0;
+	/* compare the ACGT stretches only, a byte at a time where whole */
+	for (i = 0; i <= a->n_runs; i++) {
+		end = (i < a->n_runs) ? a->runs[i].start : a->length;
+		for (j = start; j < end && (j & 3); j++)
+			if (packdna_get(a->bits, j) != packdna_get(b->bits, j))
+				return 0;
+		if (end - j >= 4) {
+			if (memcmp(a->bits + (j >> 2), b->bits + (j >> 2), (end - j) >> 2) != 0)
+				return 0;
+			j += (end - j) & ~3L;
+		}
+		for (; j < end; j++)
+			if (packdna_get(a->bits, j) != packdna_get(b->bits, j))
+				return 0;
+		if (i < a->n_runs)
+			start = a->runs[i].start + a->runs[i].length;
+	}
+	return 1;
+}
+
+static void write_u32(FILE *out, unsigned long v)
+{
+	unsigned char b[4] = { v, v >> 8, v >> 16, v >> 24 };
+
+	fwrite(b, 1, 4, out);
+}
+
+static void write_u64(FILE *out, unsigned long long v)
+{
+	write_u32(out, v);
+	write_u32(out, v >> 32);
+}
+
+void packdna_write(FILE *out, const char *name, const char *suffix, const packed_dna *p)
+{
+	long i;
+
+	fputs(PACKDNA_MAGIC, out);
+	write_u32(out, strlen(name) + strlen(suffix));
+	fputs(name, out);
+	fputs(suffix, out);
+	write_u64(out, p->length);
+	write_u64(out, p->n_runs);
+	for (i = 0; i < p->n_runs; i++) {
+		write_u64(out, p->runs[i].start);
+		write_u64(out, p->runs[i].length);
+		write_u64(out, (unsigned char) p->runs[i].base);
+	}
+	write_u64(out, p->n_masks);
+	for (i = 0; i < p->n_masks; i++) {
+		write_u64(out, p->masks[i].start);
+		write_u64(out, p->masks[i].length);
+	}
+	fwrite(p->bits, 1, PACKDNA_BYTES(p->length), out);
+}
+
+double shuffle_packed_count_log10(const packed_dna *s, int k, long max_vertices)
+{
+	long i, start, end;
+	double logc = 0, c;
+
+	start = 0;
+	for (i = 0; i <= s->n_runs; i++) {
+		end = (i < s->n_runs) ? s->runs[i].start : s->length;
+		if (end > start) {
+			shuffle1_packed(s->bits, start, end - start, k);
+			if ((c = shuffle_count_log10(max_vertices)) < 0)
+				return -1;
+			logc += c;
+		}
+		if (i < s->n_runs)
+			start = s->runs[i].start + s->runs[i].length;
+	}
+	return logc;
+}
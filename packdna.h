@@ -0,0 +1,118 @@
+/*
+   packdna - 2-bit packed nucleotide sequences for uShuffle.
+
+   Released under the same license as uShuffle (see README).
+ */
+
+/*
+ *	packdna.h - 2-bit packed DNA sequences
+ *
+ *	Bases are stored four per byte, first base in the high bits, with the
+ *	UCSC .2bit encoding (T=0, C=1, A=2, G=3). Anything that is not ACGT
+ *	(N and the IUPAC codes) is kept in a side list of runs, and lower-case
+ *	(soft-masked) stretches in a list of mask intervals. The packed bits
+ *	under a run are zero.
+ */
+#ifndef PACKDNA_H
+#define PACKDNA_H
+
+#include <stdio.h>
+
+typedef struct packed_run {
+	long start;
+	long length;
+	char base;	/* the original character of every base in the run */
+} packed_run;
+
+typedef struct packed_dna {
+	unsigned char *bits;
+	long length;
+	packed_run *runs;	/* non-ACGT runs, sorted by position */
+	long n_runs;
+	packed_run *masks;	/* lower-case intervals, sorted by position */
+	long n_masks;
+} packed_dna;
+
+extern const char packdna_base[4];
+
+static inline int packdna_get(const unsigned char *bits, long i) {
+	return (bits[i >> 2] >> (6 - 2 * (i & 3))) & 3;
+}
+
+static inline void packdna_set(unsigned char *bits, long i, int code) {
+	int shift = 6 - 2 * (i & 3);
+
+	bits[i >> 2] = (bits[i >> 2] & ~(3 << shift)) | (code << shift);
+}
+
+/* 2-bit code of an ACGT character (either case), -1 for anything else */
+int packdna_code(char c);
+
+#define PACKDNA_BYTES(l) (((l) + 3) / 4)
+
+void packdna_init(packed_dna *p);
+void packdna_free(packed_dna *p);
+
+/* pack l characters of s into p, recording runs and masks */
+void packdna_pack(packed_dna *p, const char *s, long l);
+
+/* write p->length characters to t (not NUL terminated) */
+void packdna_unpack(const packed_dna *p, char *t);
+
+/* write the len characters from position start to t (not NUL terminated) */
+void packdna_unpack_range(const packed_dna *p, long start, long len, char *t);
+
+/* compares p with the p->length characters of t, like memcmp() */
+int packdna_compare(const packed_dna *p, const char *t);
+
+/* true if a and b, with the same length and runs, have the same bases */
+int packdna_equal(const packed_dna *a, const packed_dna *b);
+
+/*
+ * Packed record format, written by packdna_write(). A file is a sequence
+ * of records, so files can be concatenated. All integers little-endian:
+ *
+ *	char	magic[4]		"UPK1"
+ *	u32	name_length
+ *	char	name[name_length]	not terminated
+ *	u64	length			bases
+ *	u64	n_runs
+ *	n_runs times: u64 start, u64 length, u64 base (character in the low byte)
+ *	u64	n_masks
+ *	n_masks times: u64 start, u64 length
+ *	u8	bits[(length + 3) / 4]	as in packed_dna; under runs not significant
+ *
+ * Runs are sorted by start and don't overlap, and so are masks. A mask
+ * may cover runs, whose base is then already in lower case.
+ */
+#define PACKDNA_MAGIC "UPK1"
+
+/* writes p as a packed record named name followed by suffix */
+void packdna_write(FILE *out, const char *name, const char *suffix, const packed_dna *p);
+
+/*
+ * k-let shuffle of a packed sequence into t, without expanding to ASCII.
+ * Non-ACGT runs and soft-masked intervals stay at their original
+ * positions; the ACGT stretches between runs are shuffled independently.
+ * t is (re)allocated by the call.
+ */
+void shuffle_packed(const packed_dna *s, packed_dna *t, int k);
+
+/*
+ * shuffle_packed() in two steps, for several shuffles of s:
+ * shuffle1_packed_dna() once, then shuffle2_packed_dna() per shuffle.
+ * The graph of a sequence with a single ACGT stretch is only built by
+ * the first; with several stretches, each shuffle2_packed_dna() rebuilds
+ * the graph of every stretch, as the engine holds one graph per thread.
+ */
+void shuffle1_packed_dna(const packed_dna *s, int k);
+void shuffle2_packed_dna(const packed_dna *s, packed_dna *t, int k);
+
+/*
+ * log10 of the number of distinct results of shuffle_packed(), or -1 if a
+ * stretch has more than max_vertices distinct (k-1)-lets (see
+ * shuffle_count_log10()). Rebuilds the graph of every stretch.
+ */
+double shuffle_packed_count_log10(const packed_dna *s, int k, long max_vertices);
+
+#endif
@@ -0,0 +1,43 @@
+/*
+   probes - static tracepoints of fasta_ushuffle.
+
+   Released under the same license as uShuffle (see README).
+ */
+
+/*
+ *	probes.h - USDT (sys/sdt.h) probes
+ *
+ *	When <sys/sdt.h> is available (systemtap-sdt-dev / systemtap-sdt-devel)
+ *	the probes below are compiled in as nops with ELF notes, which
+ *	perf, bpftrace and systemtap can attach to at run time, e.g.
+ *
+ *	  bpftrace -e 'usdt:./fasta_ushuffle:fasta_ushuffle:shuffle2__done
+ *	               { @len = hist(arg1); }'
+ *
+ *	Without it, or when built with -DNO_USDT, they compile to nothing.
+ *
+ *	Probes and arguments (index is the 0-based input record number):
+ *	  record__start(index, length, k)      record__done(index, length, k)
+ *	  shuffle1__start(index, length, k)    shuffle1__done(index, length, k)
+ *	  shuffle2__start(index, length, k)    shuffle2__done(index, length, k)
+ *	  retry(index, length, k, attempt)
+ */
+#ifndef PROBES_H
+#define PROBES_H
+
+#if !defined(NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define HAVE_USDT 1
+#endif
+#endif
+
+#ifdef HAVE_USDT
+#define PROBE3(name, a, b, c)		DTRACE_PROBE3(fasta_ushuffle, name, a, b, c)
+#define PROBE4(name, a, b, c, d)	DTRACE_PROBE4(fasta_ushuffle, name, a, b, c, d)
+#else
+#define PROBE3(name, a, b, c)		do {} while (0)
+#define PROBE4(name, a, b, c, d)	do {} while (0)
+#endif
+
+#endif
@@ -0,0 +1,189 @@
+/*
+   progress - live progress reports of fasta_ushuffle.
+
+   Released under the same license as uShuffle (see README).
+ */
+
+/*
+ *	progress.c - progress dumps on SIGUSR1 and every N seconds
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+#include <err.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "progress.h"
+
+//Counters, written by the shuffling and writer threads and read by the
+//reporter thread
+static long shuffling;		//records being shuffled
+static long records_done;
+static long bytes_done;		//input bytes of the records done
+static long longest;
+static long current_length;	//of the last record started
+
+static long input_size = -1;	//-1 when the input is not a regular file
+static double start_time;
+static unsigned report_interval;
+static pthread_t reporter;
+static int stopping;
+
+#define LOAD(x)		__atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define STORE(x,v)	__atomic_store_n(&(x), (v), __ATOMIC_RELAXED)
+
+static double now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void format_duration(char *buf, size_t size, double seconds)
+{
+	long s = (long)seconds;
+
+	snprintf(buf, size, "%ldh%02ldm%02lds", s / 3600, (s / 60) % 60, s % 60);
+}
+
+static void report(double *last_time, long *last_records, long *last_bytes)
+{
+	double t = now(), dt = t - *last_time, elapsed = t - start_time;
+	long records = LOAD(records_done), bytes = LOAD(bytes_done);
+	long current = LOAD(current_length), busy_records = LOAD(shuffling);
+	char eta[32], total[64], running[32], busy[64];
+
+	if (dt <= 0)
+		dt = 1e-9;
+	format_duration(running, sizeof(running), elapsed);
+
+	if (input_size > 0) {
+		double rate = elapsed > 0 ? bytes / elapsed : 0;
+
+		if (rate > 0 && bytes < input_size)
+			format_duration(eta, sizeof(eta), (input_size - bytes) / rate);
+		else
+			snprintf(eta, sizeof(eta), "-");
+		snprintf(total, sizeof(total), " (%.1f%% of %.1f MB)",
+			100.0 * bytes / input_size, input_size / 1e6);
+	} else {
+		snprintf(eta, sizeof(eta), "unknown");
+		total[0] = 0;
+	}
+	if (busy_records > 1)
+		snprintf(busy, sizeof(busy), ", shuffling %ld records, last started %ld bp", busy_records, current);
+	else if (busy_records == 1)
+		snprintf(busy, sizeof(busy), ", shuffling a %ld bp record", current);
+	else
+		busy[0] = 0;
+
+	fprintf(stderr, "progress: %ld records, %.1f MB of input done%s, %.0f records/s, %.2f MB/s, "
+		"ETA %s, longest record %ld bp, elapsed %s%s\n",
+		records, bytes / 1e6, total,
+		(records - *last_records) / dt, (bytes - *last_bytes) / 1e6 / dt,
+		eta, LOAD(longest), running, busy);
+
+	*last_time = t;
+	*last_records = records;
+	*last_bytes = bytes;
+}
+
+static void *reporter_main(void *arg)
+{
+	sigset_t set;
+	struct timespec timeout;
+	double last_time = start_time, next;
+	long last_records = 0, last_bytes = 0;
+	int sig;
+
+	(void) arg;
+	sigemptyset(&set);
+	sigaddset(&set, SIGUSR1);
+	next = start_time + report_interval;
+	for (;;) {
+		if (report_interval) {
+			double wait = next - now();
+
+			if (wait < 0)
+				wait = 0;
+			timeout.tv_sec = (time_t)wait;
+			timeout.tv_nsec = (long)((wait - timeout.tv_sec) * 1e9);
+			sig = sigtimedwait(&set, NULL, &timeout);
+		} else
+			sig = sigwaitinfo(&set, NULL);
+
+		if (LOAD(stopping))
+			break;
+		if (sig == SIGUSR1)
+			report(&last_time, &last_records, &last_bytes);
+		else if (sig == -1 && errno == EAGAIN) {
+			report(&last_time, &last_records, &last_bytes);
+			next += report_interval;
+		}
+	}
+	return NULL;
+}
+
+void progress_set_input_size(long bytes)
+{
+	input_size = bytes;
+}
+
+void progress_start(unsigned interval)
+{
+	struct stat st;
+	sigset_t set;
+	off_t offset;
+	int rc;
+
+	report_interval = interval;
+	start_time = now();
+	if (input_size < 0 && fstat(STDIN_FILENO, &st)==0 && S_ISREG(st.st_mode)) {
+		offset = lseek(STDIN_FILENO, 0, SEEK_CUR);
+		input_size = st.st_size - (offset > 0 ? offset : 0);
+	}
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGUSR1);
+	if ((rc = pthread_sigmask(SIG_BLOCK, &set, NULL))!=0) {
+		errno = rc;
+		err(1, "pthread_sigmask failed");
+	}
+	if ((rc = pthread_create(&reporter, NULL, reporter_main, NULL))!=0) {
+		errno = rc;
+		err(1, "pthread_create failed");
+	}
+}
+
+void progress_record_start(long length)
+{
+	long l = LOAD(longest);
+
+	__atomic_add_fetch(&shuffling, 1, __ATOMIC_RELAXED);
+	STORE(current_length, length);
+	while (length > l && !__atomic_compare_exchange_n(&longest, &l, length, 0,
+							 __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+void progress_record_end()
+{
+	__atomic_sub_fetch(&shuffling, 1, __ATOMIC_RELAXED);
+}
+
+void progress_records_done(long n, long bytes)
+{
+	STORE(records_done, records_done + n);
+	STORE(bytes_done, bytes_done + bytes);
+}
+
+void progress_stop()
+{
+	STORE(stopping, 1);
+	pthread_kill(reporter, SIGUSR1);
+	pthread_join(reporter, NULL);
+}
@@ -0,0 +1,36 @@
+/*
+   progress - live progress reports of fasta_ushuffle.
+
+   Released under the same license as uShuffle (see README).
+ */
+
+/*
+ *	progress.h - progress dumps on SIGUSR1 and every N seconds
+ */
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+/*
+   Starts the reporter thread. It prints a progress line to stderr on
+   every SIGUSR1 and, if interval is not zero, every interval seconds.
+   Must be called before any other thread is created, as it blocks
+   SIGUSR1 in the calling thread.
+ */
+void progress_start(unsigned interval);
+
+/* size of the whole input, when it is not just STDIN; call before progress_start() */
+void progress_set_input_size(long bytes);
+
+/* a shuffling thread starts and ends a record of the given length; any thread */
+void progress_record_start(long length);
+void progress_record_end();
+
+/*
+   n records of the given input bytes are written; from one thread at a
+   time, not necessarily the same
+ */
+void progress_records_done(long n, long bytes);
+
+void progress_stop();
+
+#endif
@@ -0,0 +1,101 @@
+/*
+   ring - lock-free queues of fasta_ushuffle.
+
+   Released under the same license as uShuffle (see README).
+ */
+
+/*
+ *	ring.h - bounded single-producer single-consumer ring of pointers
+ *
+ *	One thread pushes and one thread pops, without locks: each side owns
+ *	its index and publishes it with a release store, which the other
+ *	side reads with an acquire load. The indices sit on separate cache
+ *	lines so that producer and consumer don't bounce a shared line.
+ *	A side that finds the ring full or empty backs off (see backoff())
+ *	and polls again.
+ */
+#ifndef RING_H
+#define RING_H
+
+#include <stdlib.h>
+#include <err.h>
+#include <sched.h>
+#include <time.h>
+
+#define RING_CACHE_LINE 64
+
+typedef struct ring {
+	void **slots;
+	unsigned long mask;	/* capacity - 1, capacity a power of two */
+	char pad0[RING_CACHE_LINE];
+	unsigned long head;	/* next slot to pop, written by the consumer */
+	char pad1[RING_CACHE_LINE];
+	unsigned long tail;	/* next slot to push, written by the producer */
+	char pad2[RING_CACHE_LINE];
+} ring;
+
+/* a ring of at least capacity slots */
+static inline ring *ring_create(unsigned long capacity)
+{
+	ring *r;
+	unsigned long size;
+
+	for (size = 2; size < capacity; size *= 2)
+		;
+	if ((r = calloc(1, sizeof(ring)))==NULL || (r->slots = calloc(size, sizeof(void *)))==NULL)
+		err(1,"calloc failed");
+	r->mask = size - 1;
+	return r;
+}
+
+static inline void ring_free(ring *r)
+{
+	free(r->slots);
+	free(r);
+}
+
+/* returns 0 if the ring is full */
+static inline int ring_push(ring *r, void *p)
+{
+	unsigned long tail = r->tail;
+
+	if (tail - __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) > r->mask)
+		return 0;
+	r->slots[tail & r->mask] = p;
+	__atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+/* returns NULL if the ring is empty */
+static inline void *ring_pop(ring *r)
+{
+	unsigned long head = r->head;
+	void *p;
+
+	if (head == __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE))
+		return NULL;
+	p = r->slots[head & r->mask];
+	__atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+	return p;
+}
+
+/*
+   Waits a little before polling again: spins first, then yields the CPU,
+   and sleeps 50 us at a time once the wait gets long. *n counts the
+   polls and should be reset once the wait is over.
+ */
+static inline void backoff(unsigned *n)
+{
+	static const struct timespec nap = { 0, 50000 };
+
+	if (++*n < 64) {
+#if defined(__x86_64__) || defined(__i386__)
+		__builtin_ia32_pause();
+#endif
+	} else if (*n < 256)
+		sched_yield();
+	else
+		nanosleep(&nap, NULL);
+}
+
+#endif
@@ -0,0 +1,284 @@
+/*
+   stats - run statistics of fasta_ushuffle.
+
+   Released under the same license as uShuffle (see README).
+ */
+
+/*
+ *	stats.c - per-phase timing and counters for --stats
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <err.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include "ushuffle.h"
+#include "umem.h"
+#include "stats.h"
+
+bool stats_enabled = false;
+
+static const char *phase_names[N_PHASES] = {
+	"parse", "shuffle1", "shuffle2", "compare", "output", "compress"
+};
+
+//Totals, updated under lock
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static double start_ns;
+static double phase_ns[N_PHASES];
+static unsigned long records;
+static unsigned long long bases;
+static long longest;
+static unsigned long failures;
+static unsigned long *retry_histogram;	/* records by retries needed */
+static int max_retries;
+static unsigned long engine_peak, mapped_peak, huge_peak;
+
+/*
+   Log-bucketed latency histograms (in the style of HdrHistogram): each
+   power of two is split into 2^HIST_SUB_BITS buckets, so any recorded
+   value is reported within about 3% of its true value. There is one
+   histogram per latency kind and record length class, plus one over all
+   lengths.
+ */
+#define HIST_SUB_BITS	5
+#define HIST_BUCKETS	(64 << HIST_SUB_BITS)
+
+typedef struct histogram {
+	unsigned long count;
+	unsigned long max;
+	unsigned long *buckets;
+} histogram;
+
+enum { LATENCY_SHUFFLE1, LATENCY_SHUFFLE2, LATENCY_RECORD, N_LATENCIES };
+
+static const char *latency_names[N_LATENCIES] = { "shuffle1", "shuffle2", "record" };
+
+//Length classes: [0,1k), [1k,10k), ... [10M,inf), then all lengths
+#define N_LENGTH_CLASSES 6
+static const char *length_class_names[N_LENGTH_CLASSES + 1] = {
+	"<1k", "1k-10k", "10k-100k", "100k-1M", "1M-10M", ">=10M", "all"
+};
+
+static histogram latencies[N_LATENCIES][N_LENGTH_CLASSES + 1];
+
+//Phase times of the record being processed by the calling thread
+static __thread double record_ns[N_PHASES];
+
+static int hist_index(unsigned long v)
+{
+	int e;
+
+	if (v < (1UL << HIST_SUB_BITS))
+		return v;
+	e = 63 - __builtin_clzl(v);	//highest set bit
+	return ((e - HIST_SUB_BITS + 1) << HIST_SUB_BITS)
+		+ ((v >> (e - HIST_SUB_BITS)) & ((1 << HIST_SUB_BITS) - 1));
+}
+
+//highest value that lands in bucket i
+static unsigned long hist_value(int i)
+{
+	int e, shift;
+
+	if (i < (1 << HIST_SUB_BITS))
+		return i;
+	e = (i >> HIST_SUB_BITS) + HIST_SUB_BITS - 1;
+	shift = e - HIST_SUB_BITS;
+	return ((((1UL << HIST_SUB_BITS) + (i & ((1 << HIST_SUB_BITS) - 1))) << shift)
+		+ (1UL << shift) - 1);
+}
+
+static void hist_add(histogram *h, unsigned long v)
+{
+	if (h->buckets==NULL && (h->buckets = calloc(HIST_BUCKETS, sizeof(unsigned long)))==NULL)
+		err(1,"calloc failed");
+	h->buckets[hist_index(v)]++;
+	h->count++;
+	if (v > h->max)
+		h->max = v;
+}
+
+static unsigned long hist_percentile(const histogram *h, double q)
+{
+	unsigned long rank = (unsigned long)(q * h->count + 0.999999), seen = 0;
+	int i;
+
+	if (rank < 1)
+		rank = 1;
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen >= rank)
+			return hist_value(i) < h->max ? hist_value(i) : h->max;
+	}
+	return h->max;
+}
+
+static int length_class(long length)
+{
+	int c = 0;
+
+	for (length /= 1000; length > 0 && c < N_LENGTH_CLASSES - 1; length /= 10)
+		c++;
+	return c;
+}
+
+static void add_latency(int kind, int length_class, double ns)
+{
+	unsigned long v = ns > 0 ? (unsigned long)ns : 0;
+
+	hist_add(&latencies[kind][length_class], v);
+	hist_add(&latencies[kind][N_LENGTH_CLASSES], v);
+}
+
+void stats_init(int retries)
+{
+	max_retries = retries;
+	if ((retry_histogram = calloc(max_retries + 1, sizeof(unsigned long)))==NULL)
+		err(1,"calloc failed");
+	stats_enabled = true;
+	start_ns = stats_clock();
+}
+
+double stats_clock()
+{
+	struct timespec ts;
+
+	if (!stats_enabled)
+		return 0;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+void stats_add_time(stats_phase phase, double start)
+{
+	double ns;
+
+	if (!stats_enabled)
+		return;
+	ns = stats_clock() - start;
+	record_ns[phase] += ns;
+}
+
+void stats_record(long length, int retries, bool failed)
+{
+	double total = 0;
+	int c, i;
+
+	if (!stats_enabled)
+		return;
+	pthread_mutex_lock(&lock);
+	records++;
+	bases += length;
+	if (length > longest)
+		longest = length;
+	if (failed)
+		failures++;
+	else if (retries >= 0 && retries <= max_retries)
+		retry_histogram[retries]++;
+
+	c = length_class(length);
+	add_latency(LATENCY_SHUFFLE1, c, record_ns[PHASE_SHUFFLE1]);
+	add_latency(LATENCY_SHUFFLE2, c, record_ns[PHASE_SHUFFLE2]);
+	for (i = 0; i < N_PHASES; i++) {
+		total += record_ns[i];
+		phase_ns[i] += record_ns[i];
+		record_ns[i] = 0;
+	}
+	add_latency(LATENCY_RECORD, c, total);
+	pthread_mutex_unlock(&lock);
+}
+
+void stats_flush()
+{
+	int i;
+
+	if (!stats_enabled)
+		return;
+	pthread_mutex_lock(&lock);
+	for (i = 0; i < N_PHASES; i++) {
+		phase_ns[i] += record_ns[i];
+		record_ns[i] = 0;
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+void stats_sample_memory()
+{
+	shuffle_mem mem;
+
+	if (!stats_enabled)
+		return;
+	shuffle_memstats(&mem);
+	pthread_mutex_lock(&lock);
+	if (mem.peak > engine_peak)
+		engine_peak = mem.peak;
+	if (mem.huge > huge_peak)
+		huge_peak = mem.huge;
+	if (umem_mapped() > mapped_peak)
+		mapped_peak = umem_mapped();
+	pthread_mutex_unlock(&lock);
+}
+
+bool stats_write(const char *path)
+{
+	FILE *f;
+	struct rusage r;
+	int i, c, last;
+	bool first;
+
+	if (!stats_enabled)
+		return true;
+	stats_flush();
+	if ((f = fopen(path, "w"))==NULL)
+		return false;
+	getrusage(RUSAGE_SELF, &r);
+
+	fprintf(f, "{\n");
+	fprintf(f, "  \"records\": %lu,\n", records);
+	fprintf(f, "  \"bases\": %llu,\n", bases);
+	fprintf(f, "  \"longest_record\": %ld,\n", longest);
+	fprintf(f, "  \"wall_seconds\": %.6f,\n", (stats_clock() - start_ns) / 1e9);
+	fprintf(f, "  \"user_seconds\": %.6f,\n", r.ru_utime.tv_sec + r.ru_utime.tv_usec / 1e6);
+	fprintf(f, "  \"system_seconds\": %.6f,\n", r.ru_stime.tv_sec + r.ru_stime.tv_usec / 1e6);
+	fprintf(f, "  \"phase_seconds\": {");
+	for (i = 0; i < N_PHASES; i++)
+		fprintf(f, "%s\"%s\": %.6f", i ? ", " : " ", phase_names[i], phase_ns[i] / 1e9);
+	fprintf(f, " },\n");
+
+	//trailing zero buckets are left out
+	for (last = max_retries; last > 0 && retry_histogram[last] == 0; last--)
+		;
+	fprintf(f, "  \"retry_histogram\": [");
+	for (i = 0; i <= last; i++)
+		fprintf(f, "%s%lu", i ? ", " : "", retry_histogram[i]);
+	fprintf(f, "],\n");
+	fprintf(f, "  \"failed_to_find_new_shuffle\": %lu,\n", failures);
+	fprintf(f, "  \"peak_rss_kb\": %ld,\n", r.ru_maxrss);
+	fprintf(f, "  \"engine_peak_bytes\": %lu,\n", engine_peak);
+	fprintf(f, "  \"hugepage_bytes\": %lu,\n", huge_peak);
+	fprintf(f, "  \"spilled_bytes\": %lu,\n", mapped_peak);
+
+	fprintf(f, "  \"latency_ns\": {\n");
+	for (i = 0; i < N_LATENCIES; i++) {
+		fprintf(f, "    \"%s\": {\n", latency_names[i]);
+		first = true;
+		for (c = 0; c <= N_LENGTH_CLASSES; c++) {
+			const histogram *h = &latencies[i][c];
+
+			if (h->count == 0)
+				continue;
+			fprintf(f, "%s      \"%s\": { \"count\": %lu, \"p50\": %lu, \"p99\": %lu, \"p99.9\": %lu, \"max\": %lu }",
+				first ? "" : ",\n", length_class_names[c], h->count,
+				hist_percentile(h, 0.5), hist_percentile(h, 0.99),
+				hist_percentile(h, 0.999), h->max);
+			first = false;
+		}
+		fprintf(f, "\n    }%s\n", i < N_LATENCIES - 1 ? "," : "");
+	}
+	fprintf(f, "  }\n");
+	fprintf(f, "}\n");
+
+	return fclose(f)==0;
+}
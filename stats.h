@@ -0,0 +1,59 @@
+/*
+   stats - run statistics of fasta_ushuffle.
+
+   Released under the same license as uShuffle (see README).
+ */
+
+/*
+ *	stats.h - per-phase timing and counters for --stats
+ */
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+
+typedef enum {
+	PHASE_PARSE,
+	PHASE_SHUFFLE1,
+	PHASE_SHUFFLE2,
+	PHASE_COMPARE,
+	PHASE_OUTPUT,
+	PHASE_COMPRESS,
+	N_PHASES
+} stats_phase;
+
+/* true once stats_init() was called; everything else is a no-op before */
+extern bool stats_enabled;
+
+void stats_init(int max_retries);
+
+/* monotonic clock in nanoseconds, 0 when stats are disabled */
+double stats_clock();
+
+/*
+   adds the time since start (from stats_clock()) to a phase of the
+   current record of the calling thread
+ */
+void stats_add_time(stats_phase phase, double start);
+
+/*
+   Records one processed record: its length, the number of extra shuffle2
+   attempts it needed (0 if the first one was new, -1 when not retrying),
+   and whether all of them were identical to the input. The phase times
+   added since the previous record go into its latency histograms.
+ */
+void stats_record(long length, int retries, bool failed);
+
+/*
+   Adds the phase times of the calling thread that belong to no record
+   (or to a part of a record counted by another thread) to the totals.
+ */
+void stats_flush();
+
+/* samples engine memory counters after a shuffle1() */
+void stats_sample_memory();
+
+/* writes the JSON summary; returns false on I/O errors */
+bool stats_write(const char *path);
+
+#endif
@@ -0,0 +1,38 @@
+#!/bin/sh
+#
+# check.sh - compare the seeded output of short records with the one
+# recorded in test/expected.
+#
+# Short records are shuffled the way the original code did, so for a
+# given seed their output must not change. Prints one line per failing
+# case and exits non-zero if any failed.
+#
+# Environment (all optional):
+#   FASTA_USHUFFLE  binary to check (default ./fasta_ushuffle)
+#   USHUFFLE        binary to check (default ./ushuffle)
+
+FASTA_USHUFFLE=${FASTA_USHUFFLE:-./fasta_ushuffle}
+USHUFFLE=${USHUFFLE:-./ushuffle}
+EXPECTED=test/expected
+failed=0
+
+# check NAME COMMAND...
+check()
+{
+	name=$1
+	shift
+	if ! "$@" 2>/dev/null | cmp -s - "$EXPECTED/$name"; then
+		echo "FAIL: $name: $*"
+		failed=1
+	fi
+}
+
+for k in 2 3 4; do
+	check test1_s5_k$k.fa sh -c "$FASTA_USHUFFLE -s 5 -k $k < test1.fa"
+done
+for k in 3 5; do
+	check ushuffle_seed7_k$k.txt "$USHUFFLE" -seed 7 -k $k -n 3 -s TGGCCAGTAGATCTTCCCAACATAGCCTAGCTGGACATATTCACTAAACCGAACAATCTATCACCAAGCGAATCCAGAGAGTCTCATGATACCTGGAGGAAATTTGCATCATGGCGCGAA
+done
+
+[ $failed -eq 0 ] && echo "all checks passed"
+exit $failed
@@ -0,0 +1,89 @@
+/*
+   euler_check - k-let counts of the shuffles of every graph build.
+
+   Released under the same license as uShuffle (see README).
+ */
+
+/*
+ *	euler_check.c - shuffles a random DNA sequence with the 32-bit and
+ *	the 64-bit position engines (set_shuffle_width()), at let sizes that
+ *	build the graph with the hashtable and by sorting, and checks that
+ *	every shuffle keeps the first let and the k-let counts of the input.
+ *	Exits non-zero if one does not.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../ushuffle.h"
+
+#define LENGTH	600000L	/* over the 256k bases that always use the hashtable */
+
+static unsigned long state = 1;
+
+static long lcg() {
+	state = state * 6364136223846793005UL + 1442695040888963407UL;
+	return (long) (state >> 33);
+}
+
+static int cmp_code(const void *a, const void *b) {
+	unsigned long x = *(const unsigned long *) a, y = *(const unsigned long *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* the sorted 2-bit codes of the k-lets of s */
+static unsigned long *klets(const char *s, long l, int k) {
+	unsigned long *codes = malloc((l - k + 1) * sizeof(unsigned long)), c;
+	long i;
+	int j;
+
+	if (codes == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+	for (i = 0; i + k <= l; i++) {
+		for (c = 0, j = 0; j < k; j++)
+			c = c << 2 | (strchr("ACGT", s[i + j]) - "ACGT");
+		codes[i] = c;
+	}
+	qsort(codes, l - k + 1, sizeof(unsigned long), cmp_code);
+	return codes;
+}
+
+int main() {
+	static const int ks[] = { 2, 4, 12, 16 }, widths[] = { 0, 64 };
+	char *s = malloc(LENGTH + 1), *t = malloc(LENGTH + 1);
+	unsigned long *in, *out;
+	shuffle_mem mem;
+	int failed = 0, w, i, n;
+	long j;
+
+	for (j = 0; j < LENGTH; j++)
+		s[j] = "ACGT"[lcg() & 3];
+	set_randfunc(lcg);
+	for (w = 0; w < 2; w++)
+		for (i = 0; i < (int) (sizeof(ks) / sizeof(ks[0])); i++) {
+			set_shuffle_width(widths[w]);
+			shuffle1(s, LENGTH, ks[i]);
+			shuffle_memstats(&mem);
+			in = klets(s, LENGTH, ks[i]);
+			for (n = 0; n < 2; n++) {
+				shuffle2(t);
+				out = klets(t, LENGTH, ks[i]);
+				if (memcmp(s, t, ks[i] - 1) != 0
+				    || memcmp(in, out, (LENGTH - ks[i] + 1) * sizeof(unsigned long)) != 0) {
+					printf("FAIL: width %d, k %d, shuffle %d: k-let counts differ\n",
+					       widths[w], ks[i], n + 1);
+					failed = 1;
+				}
+				free(out);
+			}
+			printf("width %d, k %d: %ld vertices, %.2f bytes per base\n", shuffle_width(),
+			       ks[i], mem.n_vertices, (double) mem.peak / LENGTH);
+			free(in);
+			shuffle_reset();
+		}
+	free(s);
+	free(t);
+	return failed;
+}
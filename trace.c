@@ -0,0 +1,146 @@
+/*
+   trace - timeline export of fasta_ushuffle.
+
+   Released under the same license as uShuffle (see README).
+ */
+
+/*
+ *	trace.c - per-thread spans in Chrome trace JSON for --trace
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <err.h>
+#include <pthread.h>
+#include "trace.h"
+
+bool trace_enabled = false;
+
+typedef struct trace_event {
+	const char *name;
+	double start;	/* ns since trace_init() */
+	double duration;
+	long record;
+	long length;
+} trace_event;
+
+typedef struct trace_thread {
+	int tid;
+	const char *name;
+	trace_event *events;
+	long n_events;
+	long alloc;
+	unsigned long dropped;
+	struct trace_thread *next;
+} trace_thread;
+
+static double start_ns;
+static pthread_mutex_t threads_lock = PTHREAD_MUTEX_INITIALIZER;
+static trace_thread *threads = NULL;
+static int n_threads = 0;
+static __thread trace_thread *self = NULL;
+
+//buffer of the calling thread, registered on first use
+static trace_thread *this_thread()
+{
+	if (self)
+		return self;
+	if ((self = calloc(1, sizeof(trace_thread)))==NULL)
+		err(1,"calloc failed");
+	pthread_mutex_lock(&threads_lock);
+	self->tid = ++n_threads;
+	self->next = threads;
+	threads = self;
+	pthread_mutex_unlock(&threads_lock);
+	return self;
+}
+
+void trace_init()
+{
+	trace_enabled = true;
+	start_ns = trace_clock();
+	trace_thread_name("main");
+}
+
+double trace_clock()
+{
+	struct timespec ts;
+
+	if (!trace_enabled)
+		return 0;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+void trace_span(const char *name, double start, long record, long length)
+{
+	trace_thread *t;
+	trace_event *e;
+
+	if (!trace_enabled)
+		return;
+	t = this_thread();
+	if (t->n_events == t->alloc) {
+		if (t->alloc == TRACE_MAX_EVENTS) {
+			t->dropped++;
+			return;
+		}
+		t->alloc = t->alloc ? t->alloc * 2 : 1024;
+		if ((t->events = realloc(t->events, t->alloc * sizeof(trace_event)))==NULL)
+			err(1,"realloc failed");
+	}
+	e = &t->events[t->n_events++];
+	e->name = name;
+	e->start = start - start_ns;
+	e->duration = trace_clock() - start;
+	e->record = record;
+	e->length = length;
+}
+
+void trace_thread_name(const char *name)
+{
+	if (trace_enabled)
+		this_thread()->name = name;
+}
+
+bool trace_write(const char *path)
+{
+	FILE *f;
+	trace_thread *t;
+	const trace_event *e;
+	unsigned long dropped = 0;
+	long i;
+
+	if (!trace_enabled)
+		return true;
+	if ((f = fopen(path, "w"))==NULL)
+		return false;
+
+	pthread_mutex_lock(&threads_lock);
+	fprintf(f, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+	fprintf(f, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"fasta_ushuffle\"}}");
+	for (t = threads; t; t = t->next) {
+		if (t->name)
+			fprintf(f, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+				t->tid, t->name);
+		for (i = 0; i < t->n_events; i++) {
+			e = &t->events[i];
+			//timestamps in microseconds, as the format requires
+			fprintf(f, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f",
+				e->name, t->tid, e->start / 1e3, e->duration / 1e3);
+			if (e->record >= 0 && e->length >= 0)
+				fprintf(f, ", \"args\": {\"record\": %ld, \"length\": %ld}", e->record, e->length);
+			else if (e->record >= 0)
+				fprintf(f, ", \"args\": {\"record\": %ld}", e->record);
+			fprintf(f, "}");
+		}
+		dropped += t->dropped;
+	}
+	fprintf(f, "\n], \"otherData\": {\"dropped_spans\": %lu}}\n", dropped);
+	pthread_mutex_unlock(&threads_lock);
+
+	if (dropped)
+		fprintf(stderr, "Warning: %lu trace spans were dropped (more than %ld in a thread)\n",
+			dropped, TRACE_MAX_EVENTS);
+	return fclose(f)==0;
+}
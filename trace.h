@@ -0,0 +1,43 @@
+/*
+   trace - timeline export of fasta_ushuffle.
+
+   Released under the same license as uShuffle (see README).
+ */
+
+/*
+ *	trace.h - per-thread spans in Chrome trace JSON for --trace
+ *
+ *	The output loads in Perfetto (ui.perfetto.dev) and chrome://tracing.
+ *	Every thread keeps its own buffer of at most TRACE_MAX_EVENTS spans,
+ *	so recording takes no locks; spans beyond that are counted and
+ *	dropped.
+ */
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+
+#define TRACE_MAX_EVENTS (1L << 20)
+
+/* true once trace_init() was called; everything else is a no-op before */
+extern bool trace_enabled;
+
+void trace_init();
+
+/* monotonic clock in nanoseconds, 0 when tracing is disabled */
+double trace_clock();
+
+/*
+   Records a span of the calling thread from start (from trace_clock())
+   to now. name must be a string constant. record and length are shown
+   as the span arguments, left out when negative.
+ */
+void trace_span(const char *name, double start, long record, long length);
+
+/* names the calling thread in the timeline (a string constant) */
+void trace_thread_name(const char *name);
+
+/* writes the JSON timeline; returns false on I/O errors */
+bool trace_write(const char *path);
+
+#endif
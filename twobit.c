@@ -0,0 +1,200 @@
+/*
+   twobit - UCSC .2bit input of fasta_ushuffle.
+
+   Released under the same license as uShuffle (see README).
+ */
+
+/*
+ *	twobit.c - reading sequences of a .2bit file in memory
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include "twobit.h"
+
+#define TWOBIT_SIGNATURE 0x1A412743UL
+
+struct twobit {
+	const unsigned char *data;
+	size_t size;
+	int swap;		/* written on a machine of the other byte order */
+	long n_seqs;
+	char **names;
+	unsigned long long *offsets;
+};
+
+static unsigned long get32(const twobit *tb, size_t pos)
+{
+	const unsigned char *p = tb->data + pos;
+
+	if (pos + 4 > tb->size)
+		errx(1,"invalid .2bit input: truncated");
+	if (tb->swap)
+		return (unsigned long) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+	return p[0] | p[1] << 8 | p[2] << 16 | (unsigned long) p[3] << 24;
+}
+
+int twobit_detect(const unsigned char *head, size_t n)
+{
+	return n >= 4 && ((head[0] == 0x43 && head[1] == 0x27 && head[2] == 0x41 && head[3] == 0x1a)
+			|| (head[0] == 0x1a && head[1] == 0x41 && head[2] == 0x27 && head[3] == 0x43));
+}
+
+twobit *twobit_open(const unsigned char *data, size_t size)
+{
+	twobit *tb;
+	unsigned long version;
+	size_t pos = 16, name_size;
+	long i;
+
+	if ((tb = calloc(1, sizeof(twobit))) == NULL)
+		err(1,"calloc failed");
+	tb->data = data;
+	tb->size = size;
+	tb->swap = size >= 4 && data[0] == 0x1a;
+	if (get32(tb, 0) != TWOBIT_SIGNATURE)
+		errx(1,"invalid .2bit input: bad signature");
+	if ((version = get32(tb, 4)) > 1)
+		errx(1,"invalid .2bit input: unknown version %lu", version);
+	tb->n_seqs = get32(tb, 8);
+	if ((tb->names = calloc(tb->n_seqs + 1, sizeof(char *))) == NULL
+	    || (tb->offsets = calloc(tb->n_seqs + 1, sizeof(unsigned long long))) == NULL)
+		err(1,"calloc failed");
+
+	/* version 1 has 64-bit offsets, for files over 4 GB */
+	for (i = 0; i < tb->n_seqs; i++) {
+		if (pos >= size)
+			errx(1,"invalid .2bit input: truncated index");
+		name_size = data[pos++];
+		if (pos + name_size > size)
+			errx(1,"invalid .2bit input: truncated index");
+		if ((tb->names[i] = malloc(name_size + 1)) == NULL)
+			err(1,"malloc failed");
+		memcpy(tb->names[i], data + pos, name_size);
+		tb->names[i][name_size] = 0;
+		pos += name_size;
+		if (version == 0) {
+			tb->offsets[i] = get32(tb, pos);
+			pos += 4;
+		} else {
+			tb->offsets[i] = tb->swap ? (unsigned long long) get32(tb, pos) << 32 | get32(tb, pos + 4)
+						  : get32(tb, pos) | (unsigned long long) get32(tb, pos + 4) << 32;
+			pos += 8;
+		}
+	}
+	return tb;
+}
+
+long twobit_count(const twobit *tb)
+{
+	return tb->n_seqs;
+}
+
+const char *twobit_name(const twobit *tb, long i)
+{
+	return tb->names[i];
+}
+
+static int compare_runs(const void *a, const void *b)
+{
+	const packed_run *x = a, *y = b;
+
+	return (x->start > y->start) - (x->start < y->start);
+}
+
+/* reads a list of count blocks (starts, then sizes) at pos, sorted */
+static packed_run *read_blocks(const twobit *tb, size_t pos, long count, long length, char base)
+{
+	packed_run *r;
+	long i;
+
+	if (count == 0)
+		return NULL;
+	if (pos + 8 * (size_t) count > tb->size)
+		errx(1,"invalid .2bit input: truncated sequence record");
+	if ((r = malloc(count * sizeof(packed_run))) == NULL)
+		err(1,"malloc failed");
+	for (i = 0; i < count; i++) {
+		r[i].start = get32(tb, pos + 4 * i);
+		r[i].length = get32(tb, pos + 4 * (count + i));
+		r[i].base = base;
+		if (r[i].start + r[i].length > length)
+			errx(1,"invalid .2bit input: block beyond the end of a sequence");
+	}
+	qsort(r, count, sizeof(packed_run), compare_runs);
+	return r;
+}
+
+/* splits the N blocks where they are soft-masked, into runs of 'N' and 'n' */
+static void split_masked_runs(packed_dna *p)
+{
+	packed_run *runs = NULL, *masks = p->masks;
+	long n = 0, alloc = 0, i, m = 0, pos, end, next;
+	int masked;
+
+	for (i = 0; i < p->n_runs; i++) {
+		end = p->runs[i].start + p->runs[i].length;
+		for (pos = p->runs[i].start; pos < end; pos = next) {
+			while (m < p->n_masks && masks[m].start + masks[m].length <= pos)
+				m++;
+			masked = m < p->n_masks && masks[m].start <= pos;
+			if (masked)
+				next = masks[m].start + masks[m].length;
+			else
+				next = m < p->n_masks ? masks[m].start : end;
+			if (next > end)
+				next = end;
+			if (n == alloc) {
+				alloc = alloc ? 2 * alloc : 16;
+				if ((runs = realloc(runs, alloc * sizeof(packed_run))) == NULL)
+					err(1,"realloc failed");
+			}
+			runs[n].start = pos;
+			runs[n].length = next - pos;
+			runs[n++].base = masked ? 'n' : 'N';
+		}
+	}
+	free(p->runs);
+	p->runs = runs;
+	p->n_runs = n;
+}
+
+void twobit_sequence(const twobit *tb, long i, packed_dna *p)
+{
+	size_t pos = tb->offsets[i];
+	long n_blocks, n_masks;
+
+	packdna_init(p);
+	p->length = get32(tb, pos);
+	n_blocks = get32(tb, pos + 4);
+	p->runs = read_blocks(tb, pos + 8, n_blocks, p->length, 'N');
+	p->n_runs = n_blocks;
+	pos += 8 + 8 * (size_t) n_blocks;
+	n_masks = get32(tb, pos);
+	p->masks = read_blocks(tb, pos + 4, n_masks, p->length, 'n');
+	p->n_masks = n_masks;
+	pos += 4 + 8 * (size_t) n_masks + 4;	/* and the reserved word */
+	if (pos + PACKDNA_BYTES(p->length) > tb->size)
+		errx(1,"invalid .2bit input: truncated sequence %s", tb->names[i]);
+	p->bits = (unsigned char *) tb->data + pos;
+	if (p->n_runs > 0 && p->n_masks > 0)
+		split_masked_runs(p);
+}
+
+void twobit_release(packed_dna *p)
+{
+	free(p->runs);
+	free(p->masks);
+	packdna_init(p);
+}
+
+void twobit_close(twobit *tb)
+{
+	long i;
+
+	for (i = 0; i < tb->n_seqs; i++)
+		free(tb->names[i]);
+	free(tb->names);
+	free(tb->offsets);
+	free(tb);
+}
@@ -0,0 +1,50 @@
+/*
+   twobit - UCSC .2bit input of fasta_ushuffle.
+
+   Released under the same license as uShuffle (see README).
+ */
+
+/*
+ *	twobit.h - reading sequences of a .2bit file in memory
+ *
+ *	A .2bit file holds an index of its sequences, then for every
+ *	sequence its length, its N blocks, its soft-masked blocks and its
+ *	bases packed four per byte with the encoding of packdna.h. The
+ *	sequences are read in place from the file image (typically mapped
+ *	with mmap): any sequence can be taken without reading the ones
+ *	before it, and the packed bases are used as they are, without a
+ *	copy.
+ */
+#ifndef TWOBIT_H
+#define TWOBIT_H
+
+#include <stddef.h>
+#include "packdna.h"
+
+/* bytes of the start of a file that twobit_detect() needs */
+#define TWOBIT_MAGIC_BYTES 4
+
+/* true if a file starting with the n bytes of head is a .2bit file */
+int twobit_detect(const unsigned char *head, size_t n);
+
+typedef struct twobit twobit;
+
+/* reads the index of the .2bit file image data; exits if it is not valid */
+twobit *twobit_open(const unsigned char *data, size_t size);
+
+long twobit_count(const twobit *tb);
+const char *twobit_name(const twobit *tb, long i);
+
+/*
+   Sequence i as a packed sequence: the bits point into the file image,
+   the N blocks are runs of 'N' ('n' where soft-masked) and the masked
+   blocks are masks. Release it with twobit_release(), not packdna_free().
+ */
+void twobit_sequence(const twobit *tb, long i, packed_dna *p);
+
+void twobit_release(packed_dna *p);
+
+/* frees the index; the file image stays the caller's */
+void twobit_close(twobit *tb);
+
+#endif
@@ -0,0 +1,458 @@
+/*
+   umem - accounted memory for the uShuffle engine.
+
+   Released under the same license as uShuffle (see README).
+ */
+
+/*
+ *	umem.c - allocation with byte accounting
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "umem.h"
+
+/* footprint of the calling thread */
+static __thread size_t current = 0;
+static __thread size_t peak = 0;
+static __thread size_t current_huge = 0;	/* the part on huge pages */
+
+/* the process-wide counters and the mapping registry below */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* out-of-core mode, see umem_set_limit() */
+static size_t max_memory = 0;
+static const char *tmpdir = NULL;
+static size_t heap = 0;		/* bytes currently in RAM, updated atomically */
+static size_t mapped = 0;	/* bytes currently in temporary files */
+
+/* huge pages, see umem_set_hugepages() */
+#define HUGE_PAGE	(2UL << 20)
+
+static int hugepages = UMEM_HUGE_OFF;
+static size_t huge_thp = 0;	/* bytes currently advised MADV_HUGEPAGE */
+static size_t huge_tlb = 0;	/* bytes currently on hugetlbfs pages */
+
+/* blocks that did not come from malloc: temporary files and huge pages */
+typedef struct mapping {
+	void *p;
+	size_t size;
+	size_t len;	/* length of the mapping */
+	int kind;
+	struct mapping *next;
+} mapping;
+
+enum { MAP_KIND_FILE, MAP_KIND_THP, MAP_KIND_HUGETLB };
+
+static mapping *mappings = NULL;
+
+/*
+ * blocks under SMALL_BLOCK, such as the graphs of short records, always
+ * come from malloc and don't take the lock: they only add to the heap
+ * counter, which is why it is atomic
+ */
+#define SMALL_BLOCK	(256UL << 10)
+
+static void heap_add(size_t n) {
+	__atomic_add_fetch(&heap, n, __ATOMIC_RELAXED);
+}
+
+static void heap_sub(size_t n) {
+	__atomic_sub_fetch(&heap, n, __ATOMIC_RELAXED);
+}
+
+static size_t heap_now() {
+	return __atomic_load_n(&heap, __ATOMIC_RELAXED);
+}
+
+static void account(size_t old_size, size_t new_size) {
+	current = current - old_size + new_size;
+	if (current > peak)
+		peak = current;
+}
+
+void umem_set_limit(size_t max, const char *dir) {
+	max_memory = max;
+	tmpdir = dir;
+}
+
+void umem_set_hugepages(int mode) {
+	hugepages = mode;
+}
+
+static void add_mapping(void *p, size_t size, size_t len, int kind) {
+	mapping *m;
+
+	if ((m = malloc(sizeof(mapping))) == NULL) {
+		fprintf(stderr, "umem: malloc failed\n");
+		exit(1);
+	}
+	m->p = p;
+	m->size = size;
+	m->len = len;
+	m->kind = kind;
+	m->next = mappings;
+	mappings = m;
+	switch (kind) {
+	case MAP_KIND_FILE:
+		mapped += size;
+		break;
+	case MAP_KIND_THP:
+		huge_thp += len;
+		heap_add(size);
+		break;
+	case MAP_KIND_HUGETLB:
+		huge_tlb += len;
+		heap_add(size);
+		break;
+	}
+}
+
+/*
+ * zero-filled anonymous memory on huge pages: explicit hugetlbfs pages if
+ * asked for and available, otherwise a 2 MB aligned mapping advised for
+ * transparent huge pages. Returns NULL if huge pages can't be used.
+ */
+static void *map_huge(size_t size) {
+	size_t len = (size + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1);
+	char *p, *aligned;
+
+#ifdef MAP_HUGETLB
+	if (hugepages == UMEM_HUGE_HUGETLB) {
+		p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (p != MAP_FAILED) {
+			add_mapping(p, size, len, MAP_KIND_HUGETLB);
+			return p;
+		}
+	}
+#endif
+#ifdef MADV_HUGEPAGE
+	/* over-allocate by one huge page and trim to a 2 MB boundary */
+	p = mmap(NULL, len + HUGE_PAGE, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		return NULL;
+	aligned = (char *) (((unsigned long) p + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1));
+	if (aligned > p)
+		munmap(p, aligned - p);
+	munmap(aligned + len, p + HUGE_PAGE - aligned);
+	madvise(aligned, len, MADV_HUGEPAGE);
+	add_mapping(aligned, size, len, MAP_KIND_THP);
+	return aligned;
+#else
+	(void) p; (void) aligned;
+	return NULL;
+#endif
+}
+
+/* zero-filled allocation backed by an unlinked file in tmpdir */
+static void *map_file(size_t size) {
+	const char *dir = tmpdir ? tmpdir : (getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp");
+	char *path;
+	void *p;
+	int fd;
+
+	if ((path = malloc(strlen(dir) + 32)) == NULL) {
+		fprintf(stderr, "umem: malloc failed\n");
+		exit(1);
+	}
+	sprintf(path, "%s/ushuffle.XXXXXX", dir);
+	if ((fd = mkstemp(path)) == -1) {
+		fprintf(stderr, "umem: can't create temporary file in %s: %m\n", dir);
+		exit(1);
+	}
+	unlink(path);
+	if (ftruncate(fd, size ? size : 1) == -1) {
+		fprintf(stderr, "umem: can't extend temporary file in %s to %zu bytes: %m\n", dir, size);
+		exit(1);
+	}
+	p = mmap(NULL, size ? size : 1, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED) {
+		fprintf(stderr, "umem: mmap of %zu bytes in %s failed: %m\n", size, dir);
+		exit(1);
+	}
+	close(fd);
+	free(path);
+
+	add_mapping(p, size, size ? size : 1, MAP_KIND_FILE);
+	return p;
+}
+
+static int is_mapped(const void *p) {
+	mapping *m;
+
+	for (m = mappings; m != NULL; m = m->next)
+		if (m->p == p)
+			return 1;
+	return 0;
+}
+
+/* length of p on huge pages, 0 if it is not a huge page mapping */
+static size_t huge_len(const void *p) {
+	mapping *m;
+
+	for (m = mappings; m != NULL; m = m->next)
+		if (m->p == p)
+			return m->kind == MAP_KIND_FILE ? 0 : m->len;
+	return 0;
+}
+
+/*
+ * shrink the huge page mapping p to size in place, unmapping the huge
+ * pages past it; returns 0 if p is not a huge page mapping
+ */
+static int shrink_huge(void *p, size_t size) {
+	size_t len = (size + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1);
+	mapping *m;
+
+	if (len == 0)
+		len = HUGE_PAGE;
+	for (m = mappings; m != NULL; m = m->next)
+		if (m->p == p) {
+			if (m->kind == MAP_KIND_FILE)
+				return 0;
+			if (len < m->len) {
+				munmap((char *) p + len, m->len - len);
+				if (m->kind == MAP_KIND_THP)
+					huge_thp -= m->len - len;
+				else
+					huge_tlb -= m->len - len;
+				m->len = len;
+			}
+			heap_sub(m->size);
+			heap_add(size);
+			m->size = size;
+			return 1;
+		}
+	return 0;
+}
+
+/* unmap p if it is a mapping, returns 0 if it is a malloc block */
+static int unmap(void *p) {
+	mapping **pm, *m;
+
+	for (pm = &mappings; (m = *pm) != NULL; pm = &m->next)
+		if (m->p == p) {
+			munmap(m->p, m->len);
+			if (m->kind == MAP_KIND_FILE)
+				mapped -= m->size;
+			else
+				heap_sub(m->size);
+			if (m->kind == MAP_KIND_THP)
+				huge_thp -= m->len;
+			if (m->kind == MAP_KIND_HUGETLB)
+				huge_tlb -= m->len;
+			*pm = m->next;
+			free(m);
+			return 1;
+		}
+	return 0;
+}
+
+static void *alloc(size_t size) {
+	void *mem = NULL;
+
+	if (max_memory == 0 || heap_now() + size <= max_memory) {
+		if (hugepages != UMEM_HUGE_OFF && size >= HUGE_PAGE
+		    && (mem = map_huge(size)) != NULL)
+			return mem;
+		if ((mem = calloc(1, size ? size : 1)) != NULL) {
+			heap_add(size);
+			return mem;
+		}
+		if (max_memory == 0 && tmpdir == NULL) {
+			fprintf(stderr, "umem_alloc: allocation of %zu bytes failed\n", size);
+			exit(1);
+		}
+	}
+	/* over the memory budget, or the heap is exhausted: spill to disk */
+	return map_file(size);
+}
+
+static void release(void *p, size_t size) {
+	if (p == NULL)
+		return;
+	if (!unmap(p)) {
+		free(p);
+		heap_sub(size);
+	}
+}
+
+/* mine: count the block in the footprint of the calling thread */
+static void *allocate(size_t size, int mine) {
+	void *mem;
+
+	if (size < SMALL_BLOCK) {
+		if ((mem = calloc(1, size ? size : 1)) == NULL) {
+			fprintf(stderr, "umem_alloc: allocation of %zu bytes failed\n", size);
+			exit(1);
+		}
+		heap_add(size);
+		if (mine)
+			account(0, size);
+		return mem;
+	}
+	pthread_mutex_lock(&lock);
+	mem = alloc(size);
+	if (mine)
+		current_huge += huge_len(mem);
+	pthread_mutex_unlock(&lock);
+	if (mine)
+		account(0, size);
+	return mem;
+}
+
+static void *reallocate(void *p, size_t old_size, size_t new_size, int mine) {
+	size_t old_huge;
+	char *mem;
+	int in_place;
+
+	if (old_size < SMALL_BLOCK && new_size < SMALL_BLOCK) {	/* malloc to malloc */
+		if ((mem = realloc(p, new_size ? new_size : 1)) == NULL) {
+			fprintf(stderr, "umem_realloc: allocation of %zu bytes failed\n", new_size);
+			exit(1);
+		}
+		if (new_size > old_size)
+			memset(mem + old_size, 0, new_size - old_size);
+		heap_add(new_size);
+		heap_sub(old_size);
+		if (mine)
+			account(old_size, new_size);
+		return mem;
+	}
+
+	/*
+	 * shrink huge pages in place, as long as they stay a large block;
+	 * otherwise reserve the growth on the heap, then realloc outside the
+	 * lock
+	 */
+	pthread_mutex_lock(&lock);
+	old_huge = p != NULL ? huge_len(p) : 0;
+	if (p != NULL && new_size <= old_size && new_size >= SMALL_BLOCK
+	    && shrink_huge(p, new_size)) {
+		if (mine)
+			current_huge = current_huge - old_huge + huge_len(p);
+		pthread_mutex_unlock(&lock);
+		if (mine)
+			account(old_size, new_size);
+		return p;
+	}
+	in_place = p != NULL && !is_mapped(p)
+	    && (new_size <= old_size
+		|| ((max_memory == 0 || heap_now() - old_size + new_size <= max_memory)
+		    && (hugepages == UMEM_HUGE_OFF || new_size < HUGE_PAGE)));
+	if (in_place) {
+		heap_add(new_size);
+		heap_sub(old_size);
+	}
+	pthread_mutex_unlock(&lock);
+
+	if (in_place) {
+		if ((mem = realloc(p, new_size ? new_size : 1)) != NULL) {
+			if (new_size > old_size)
+				memset(mem + old_size, 0, new_size - old_size);
+			if (mine)
+				account(old_size, new_size);
+			return mem;
+		}
+		heap_add(old_size);
+		heap_sub(new_size);
+	}
+
+	/*
+	 * move to a fresh block, which may be file-backed: both blocks are
+	 * held until the copy is done
+	 */
+	mem = allocate(new_size, mine);
+	if (p != NULL)
+		memcpy(mem, p, old_size < new_size ? old_size : new_size);
+	pthread_mutex_lock(&lock);
+	release(p, old_size);
+	if (mine)
+		current_huge -= old_huge;
+	pthread_mutex_unlock(&lock);
+	if (mine)
+		account(old_size, 0);
+	return mem;
+}
+
+static void deallocate(void *p, size_t size, int mine) {
+	if (p == NULL)
+		return;
+	if (size < SMALL_BLOCK) {
+		free(p);
+		heap_sub(size);
+		if (mine)
+			account(size, 0);
+		return;
+	}
+	pthread_mutex_lock(&lock);
+	if (mine)
+		current_huge -= huge_len(p);
+	release(p, size);
+	pthread_mutex_unlock(&lock);
+	if (mine)
+		account(size, 0);
+}
+
+void *umem_buffer_alloc(size_t size) {
+	return allocate(size, 0);
+}
+
+void *umem_alloc(size_t size) {
+	return allocate(size, 1);
+}
+
+void *umem_buffer_realloc(void *p, size_t old_size, size_t new_size) {
+	return reallocate(p, old_size, new_size, 0);
+}
+
+void *umem_realloc(void *p, size_t old_size, size_t new_size) {
+	return reallocate(p, old_size, new_size, 1);
+}
+
+void umem_buffer_free(void *p, size_t size) {
+	deallocate(p, size, 0);
+}
+
+void umem_free(void *p, size_t size) {
+	deallocate(p, size, 1);
+}
+
+size_t umem_current() {
+	return current;
+}
+
+size_t umem_current_huge() {
+	return current_huge;
+}
+
+size_t umem_peak() {
+	return peak;
+}
+
+size_t umem_mapped() {
+	size_t n;
+
+	pthread_mutex_lock(&lock);
+	n = mapped;
+	pthread_mutex_unlock(&lock);
+	return n;
+}
+
+size_t umem_huge(int mode) {
+	size_t n;
+
+	pthread_mutex_lock(&lock);
+	n = mode == UMEM_HUGE_HUGETLB ? huge_tlb : huge_thp;
+	pthread_mutex_unlock(&lock);
+	return n;
+}
+
+void umem_reset_peak() {
+	peak = current;
+}
@@ -0,0 +1,79 @@
+/*
+   umem - accounted memory for the uShuffle engine.
+
+   Released under the same license as uShuffle (see README).
+ */
+
+/*
+ *	umem.h - allocation with byte accounting
+ *
+ *	All large engine allocations go through here so that the peak
+ *	footprint of shuffle1() can be measured and reported, and so do the
+ *	input blocks of fasta_ushuffle, to keep them in the memory limit.
+ *	Callers pass the size back when freeing.
+ */
+#ifndef UMEM_H
+#define UMEM_H
+
+#include <stddef.h>
+
+/* zero-filled allocation; prints an error and exits on failure */
+void *umem_alloc(size_t size);
+
+/* resize, zero-filling any growth; p may be NULL with old_size 0 */
+void *umem_realloc(void *p, size_t old_size, size_t new_size);
+
+void umem_free(void *p, size_t size);
+
+/*
+ * the same for buffers handed between threads, such as input blocks:
+ * they count against the memory limit but not against the footprint of
+ * the calling thread
+ */
+void *umem_buffer_alloc(size_t size);
+void *umem_buffer_realloc(void *p, size_t old_size, size_t new_size);
+void umem_buffer_free(void *p, size_t size);
+
+/*
+ * out-of-core mode: once max_memory bytes (0 = unlimited) are on the
+ * heap, further allocations are backed by unlinked temporary files in
+ * tmpdir (NULL = $TMPDIR or /tmp) and paged by the kernel. When a tmpdir
+ * is given, a failed heap allocation also falls back to a file. Blocks
+ * under 256 KB always stay on the heap, where they still count. Nothing
+ * orders the accesses for the disk: the engine sorts and walks its arrays
+ * at random, so this avoids an allocation failure, not the paging.
+ */
+void umem_set_limit(size_t max_memory, const char *tmpdir);
+
+/*
+ * huge pages for allocations of 2 MB and more: UMEM_HUGE_THP maps them
+ * 2 MB aligned and advises MADV_HUGEPAGE, UMEM_HUGE_HUGETLB first tries
+ * explicit hugetlbfs pages (MAP_HUGETLB) and falls back to THP.
+ */
+enum {
+	UMEM_HUGE_OFF,
+	UMEM_HUGE_THP,
+	UMEM_HUGE_HUGETLB
+};
+
+void umem_set_hugepages(int mode);
+
+/*
+ * bytes allocated by the calling thread, and the part of them mapped on
+ * huge pages (the memory limit and the other counters are process-wide).
+ * A block moved by a realloc counts twice until the copy is done.
+ */
+size_t umem_current();
+size_t umem_current_huge();
+size_t umem_peak();
+
+/* bytes currently held in temporary files */
+size_t umem_mapped();
+
+/* bytes currently mapped with huge pages of the given kind */
+size_t umem_huge(int mode);
+
+/* restart peak tracking from the current footprint */
+void umem_reset_peak();
+
+#endif
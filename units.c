@@ -0,0 +1,55 @@
+/*
+   units - lengths and sizes with K/M/G suffixes on the command line.
+
+   Released under the same license as uShuffle (see README).
+ */
+
+/*
+ *	units.c - command-line numbers with unit suffixes
+ */
+#include <ctype.h>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "units.h"
+
+/* the number at s times unit for each place of its suffix in suffixes; NaN if none */
+static double scaled(const char *s, const char *suffixes, double unit, char **end)
+{
+	double v = strtod(s, end);
+	const char *p;
+
+	if (*end == s)
+		return NAN;
+	if (**end != '\0' && (p = strchr(suffixes, toupper((unsigned char) **end))) != NULL) {
+		for (; p >= suffixes; p--)
+			v *= unit;
+		++*end;
+	}
+	return v;
+}
+
+long units_length(const char *s, const char **rest)
+{
+	char *end;
+	double v = scaled(s, "KMG", 1000, &end);
+
+	/* the comparisons are false for NaN; LONG_MAX rounds up to 2^63 */
+	if (!(v >= 0 && v < (double) LONG_MAX) || (rest == NULL && *end != '\0'))
+		return -1;
+	if (rest != NULL)
+		*rest = end;
+	return (long) v;
+}
+
+size_t units_size(const char *s)
+{
+	char *end;
+	double v = scaled(s, "KMGT", 1024, &end);
+
+	if (!(v > 0 && v < (double) SIZE_MAX) || *end != '\0')
+		return 0;
+	return (size_t) v;
+}
@@ -0,0 +1,29 @@
+/*
+   units - lengths and sizes with K/M/G suffixes on the command line.
+
+   Released under the same license as uShuffle (see README).
+ */
+
+/*
+ *	units.h - command-line numbers with unit suffixes
+ */
+#ifndef UNITS_H
+#define UNITS_H
+
+#include <stddef.h>
+
+/*
+   Parses a length with an optional decimal suffix K, M or G (thousands,
+   millions, billions): 1.5k is 1500. What follows the suffix is stored
+   in *rest, or must be empty when rest is NULL. Returns -1 if s is not
+   such a length, is negative, or exceeds LONG_MAX.
+ */
+long units_length(const char *s, const char **rest);
+
+/*
+   Parses a byte count with an optional binary suffix K, M, G or T.
+   Returns 0 on invalid input, or a count that does not fit a size_t.
+ */
+size_t units_size(const char *s);
+
+#endif
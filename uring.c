@@ -0,0 +1,435 @@
+/*
+   uring - io_uring input and output of fasta_ushuffle.
+
+   Released under the same license as uShuffle (see README).
+ */
+
+/*
+ *	uring.c - asynchronous reading and writing of regular files
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#include "uring.h"
+
+/* one submission and completion queue pair, used by a single thread */
+typedef struct ioring {
+	int fd;
+	unsigned *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ring, *cq_ring;
+	size_t sq_size, cq_size, sqes_size;
+	unsigned to_submit;
+} ioring;
+
+static int ioring_setup(ioring *r, unsigned entries)
+{
+	struct io_uring_params p;
+	char *sq, *cq;
+
+	memset(r, 0, sizeof(*r));
+	memset(&p, 0, sizeof(p));
+	if ((r->fd = syscall(__NR_io_uring_setup, entries, &p)) < 0)
+		return -1;
+
+	r->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	r->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		r->sq_size = r->cq_size = r->sq_size > r->cq_size ? r->sq_size : r->cq_size;
+	r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	r->sq_ring = mmap(NULL, r->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			r->fd, IORING_OFF_SQ_RING);
+	if (r->sq_ring == MAP_FAILED)
+		goto fail;
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		r->cq_ring = r->sq_ring;
+	else if ((r->cq_ring = mmap(NULL, r->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			r->fd, IORING_OFF_CQ_RING)) == MAP_FAILED) {
+		munmap(r->sq_ring, r->sq_size);
+		goto fail;
+	}
+	r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			r->fd, IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED) {
+		if (r->cq_ring != r->sq_ring)
+			munmap(r->cq_ring, r->cq_size);
+		munmap(r->sq_ring, r->sq_size);
+		goto fail;
+	}
+
+	sq = r->sq_ring;
+	cq = r->cq_ring;
+	r->sq_tail = (unsigned *) (sq + p.sq_off.tail);
+	r->sq_mask = (unsigned *) (sq + p.sq_off.ring_mask);
+	r->sq_array = (unsigned *) (sq + p.sq_off.array);
+	r->cq_head = (unsigned *) (cq + p.cq_off.head);
+	r->cq_tail = (unsigned *) (cq + p.cq_off.tail);
+	r->cq_mask = (unsigned *) (cq + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+	return 0;
+
+fail:
+	close(r->fd);
+	return -1;
+}
+
+static void ioring_free(ioring *r)
+{
+	munmap(r->sqes, r->sqes_size);
+	if (r->cq_ring != r->sq_ring)
+		munmap(r->cq_ring, r->cq_size);
+	munmap(r->sq_ring, r->sq_size);
+	close(r->fd);
+}
+
+/* the next submission entry, cleared; the callers never queue more than the ring holds */
+static struct io_uring_sqe *ioring_sqe(ioring *r)
+{
+	unsigned tail = *r->sq_tail, index = tail & *r->sq_mask;
+	struct io_uring_sqe *sqe = &r->sqes[index];
+
+	memset(sqe, 0, sizeof(*sqe));
+	r->sq_array[index] = index;
+	__atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	r->to_submit++;
+	return sqe;
+}
+
+/* submits the queued entries, and waits for min_complete completions */
+static void ioring_enter(ioring *r, unsigned min_complete)
+{
+	int n;
+
+	if (r->to_submit == 0 && min_complete == 0)
+		return;
+	do
+		n = syscall(__NR_io_uring_enter, r->fd, r->to_submit, min_complete,
+			min_complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+	while (n < 0 && errno == EINTR);
+	if (n < 0)
+		err(1,"io_uring_enter failed");
+	r->to_submit -= n;
+}
+
+/* takes a completion, if there is one */
+static int ioring_reap(ioring *r, unsigned long long *user_data, int *res)
+{
+	unsigned head = *r->cq_head;
+	struct io_uring_cqe *cqe;
+
+	if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+		return 0;
+	cqe = &r->cqes[head & *r->cq_mask];
+	*user_data = cqe->user_data;
+	*res = cqe->res;
+	__atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+/* io_uring works on regular files without O_APPEND, from their current offset */
+static int usable_fd(int fd, off_t *offset)
+{
+	struct stat st;
+	int flags;
+
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+		return 0;
+	if ((flags = fcntl(fd, F_GETFL)) < 0 || (flags & O_APPEND))
+		return 0;
+	return (*offset = lseek(fd, 0, SEEK_CUR)) >= 0;
+}
+
+/*
+   Input: a circle of depth buffers, each either being read or holding
+   the data of the next chunk of the file. The consumer empties them in
+   file order, and each emptied buffer is sent again for the chunk
+   depth chunks further. A read may return less than asked (signals,
+   network file systems): the rest of the chunk is then read again, and
+   only a read of nothing is the end of the file.
+ */
+typedef struct input_slot {
+	off_t offset;		/* of the chunk */
+	size_t len, pos;
+	int ready;
+	int end;		/* the file ends in this chunk */
+} input_slot;
+
+struct uring_input {
+	ioring r;
+	int fd;
+	int depth, head;	/* head: the buffer being consumed */
+	int in_flight;
+	int fixed;		/* buffers registered */
+	size_t chunk;
+	off_t next_offset;	/* of the next read to send */
+	char *buffers;
+	input_slot *slots;
+	int eof;
+};
+
+/* reads the part of the chunk of buffer i not read yet */
+static void input_read_rest(uring_input *in, int i)
+{
+	struct io_uring_sqe *sqe = ioring_sqe(&in->r);
+	input_slot *s = &in->slots[i];
+
+	sqe->opcode = in->fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+	sqe->fd = in->fd;
+	sqe->addr = (unsigned long) (in->buffers + i * in->chunk + s->len);
+	sqe->len = in->chunk - s->len;
+	sqe->off = s->offset + s->len;
+	sqe->buf_index = in->fixed ? i : 0;
+	sqe->user_data = i;
+	in->in_flight++;
+}
+
+static void input_send(uring_input *in, int i)
+{
+	input_slot *s = &in->slots[i];
+
+	s->offset = in->next_offset;
+	s->len = s->pos = 0;
+	s->ready = s->end = 0;
+	in->next_offset += in->chunk;
+	input_read_rest(in, i);
+}
+
+uring_input *uring_input_open(int fd, int depth, size_t chunk)
+{
+	uring_input *in;
+	struct iovec *iov;
+	off_t offset;
+	int i;
+
+	if (!usable_fd(fd, &offset))
+		return NULL;
+	if ((in = calloc(1, sizeof(uring_input))) == NULL)
+		err(1,"calloc failed");
+	if (ioring_setup(&in->r, depth) != 0) {
+		free(in);
+		return NULL;
+	}
+	in->fd = fd;
+	in->depth = depth;
+	in->chunk = chunk;
+	in->next_offset = offset;
+	if ((in->buffers = mmap(NULL, depth * chunk, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED
+	    || (in->slots = calloc(depth, sizeof(input_slot))) == NULL
+	    || (iov = calloc(depth, sizeof(struct iovec))) == NULL)
+		err(1,"can't allocate the input buffers");
+
+	/* registered buffers save pinning them on every read; not fatal (RLIMIT_MEMLOCK) */
+	for (i = 0; i < depth; i++) {
+		iov[i].iov_base = in->buffers + i * chunk;
+		iov[i].iov_len = chunk;
+	}
+	in->fixed = syscall(__NR_io_uring_register, in->r.fd, IORING_REGISTER_BUFFERS, iov, depth) == 0;
+	free(iov);
+
+	for (i = 0; i < depth; i++)
+		input_send(in, i);
+	ioring_enter(&in->r, 0);
+	return in;
+}
+
+ssize_t uring_input_read(uring_input *in, void *buf, size_t len)
+{
+	input_slot *s = &in->slots[in->head];
+	unsigned long long i;
+	int res;
+	size_t n;
+
+	if (in->eof)
+		return 0;
+	while (!s->ready) {
+		ioring_enter(&in->r, 1);
+		while (ioring_reap(&in->r, &i, &res)) {
+			in->in_flight--;
+			if (res == -EINTR || res == -EAGAIN)
+				input_read_rest(in, i);	/* nothing read: again */
+			else if (res < 0) {
+				errno = -res;
+				return -1;
+			} else if (res == 0)
+				in->slots[i].end = in->slots[i].ready = 1;
+			else if ((in->slots[i].len += res) == in->chunk)
+				in->slots[i].ready = 1;
+			else
+				input_read_rest(in, i);
+		}
+	}
+
+	n = s->len - s->pos < len ? s->len - s->pos : len;
+	memcpy(buf, in->buffers + in->head * in->chunk + s->pos, n);
+	s->pos += n;
+	if (s->pos == s->len) {
+		if (s->end) {
+			in->eof = 1;
+			return n;
+		}
+		input_send(in, in->head);
+		ioring_enter(&in->r, 0);
+		in->head = (in->head + 1) % in->depth;
+	}
+	return n;
+}
+
+void uring_input_close(uring_input *in)
+{
+	unsigned long long i;
+	int res;
+
+	while (in->in_flight > 0) {
+		ioring_enter(&in->r, 1);
+		while (ioring_reap(&in->r, &i, &res))
+			in->in_flight--;
+	}
+	ioring_free(&in->r);
+	munmap(in->buffers, in->depth * in->chunk);
+	free(in->slots);
+	free(in);
+}
+
+/*
+   Output: every queued write takes a slot, which holds what to do when
+   it completes. Writes are submitted once depth/2 are queued, or when
+   the caller has nothing more to write for now.
+ */
+typedef struct output_slot {
+	const char *buf;
+	size_t len;
+	off_t offset;
+	uring_done_fn done;
+	void *arg;
+} output_slot;
+
+struct uring_output {
+	ioring r;
+	int fd;
+	int depth;
+	int *free_slots, n_free;
+	int queued;		/* not submitted yet */
+	off_t offset;		/* of the next write */
+	output_slot *slots;
+};
+
+uring_output *uring_output_open(int fd, int depth)
+{
+	uring_output *out;
+	off_t offset;
+	int i;
+
+	if (!usable_fd(fd, &offset))
+		return NULL;
+	if ((out = calloc(1, sizeof(uring_output))) == NULL)
+		err(1,"calloc failed");
+	if (ioring_setup(&out->r, depth) != 0) {
+		free(out);
+		return NULL;
+	}
+	out->fd = fd;
+	out->depth = depth;
+	out->offset = offset;
+	if ((out->slots = calloc(depth, sizeof(output_slot))) == NULL
+	    || (out->free_slots = malloc(depth * sizeof(int))) == NULL)
+		err(1,"calloc failed");
+	for (i = 0; i < depth; i++)
+		out->free_slots[out->n_free++] = i;
+	return out;
+}
+
+static void output_complete(uring_output *out, int i, int res)
+{
+	output_slot *s = &out->slots[i];
+	ssize_t n;
+
+	if (res < 0) {
+		errno = -res;
+		err(1,"write failed");
+	}
+	/* finish a short write synchronously */
+	for (s->buf += res, s->len -= res, s->offset += res; s->len > 0;
+	     s->buf += n, s->len -= n, s->offset += n)
+		if ((n = pwrite(out->fd, s->buf, s->len, s->offset)) < 0)
+			err(1,"write failed");
+	if (s->done)
+		s->done(s->arg);
+	out->free_slots[out->n_free++] = i;
+}
+
+static void output_reap(uring_output *out)
+{
+	unsigned long long i;
+	int res;
+
+	while (ioring_reap(&out->r, &i, &res))
+		output_complete(out, i, res);
+}
+
+void uring_output_write(uring_output *out, const void *buf, size_t len,
+			uring_done_fn done, void *arg)
+{
+	struct io_uring_sqe *sqe;
+	output_slot *s;
+	int i;
+
+	output_reap(out);
+	while (out->n_free == 0) {
+		ioring_enter(&out->r, 1);
+		out->queued = 0;
+		output_reap(out);
+	}
+	i = out->free_slots[--out->n_free];
+	s = &out->slots[i];
+	s->buf = buf;
+	s->len = len;
+	s->offset = out->offset;
+	s->done = done;
+	s->arg = arg;
+	out->offset += len;
+
+	sqe = ioring_sqe(&out->r);
+	sqe->opcode = IORING_OP_WRITE;
+	sqe->fd = out->fd;
+	sqe->addr = (unsigned long) buf;
+	sqe->len = len < (1U << 30) ? len : (1U << 30);	/* the rest is written on completion */
+	sqe->off = s->offset;
+	sqe->user_data = i;
+	if (++out->queued >= out->depth / 2) {
+		ioring_enter(&out->r, 0);
+		out->queued = 0;
+	}
+}
+
+void uring_output_submit(uring_output *out)
+{
+	ioring_enter(&out->r, 0);
+	out->queued = 0;
+	output_reap(out);
+}
+
+void uring_output_close(uring_output *out)
+{
+	while (out->n_free < out->depth) {
+		ioring_enter(&out->r, 1);
+		output_reap(out);
+	}
+	if (lseek(out->fd, out->offset, SEEK_SET) < 0)
+		err(1,"lseek failed");
+	ioring_free(&out->r);
+	free(out->slots);
+	free(out->free_slots);
+	free(out);
+}
@@ -0,0 +1,60 @@
+/*
+   uring - io_uring input and output of fasta_ushuffle.
+
+   Released under the same license as uShuffle (see README).
+ */
+
+/*
+ *	uring.h - asynchronous reading and writing of regular files
+ *
+ *	Talks to the kernel with the raw io_uring system calls, so that no
+ *	library is needed. An input keeps several large reads in flight
+ *	ahead of the consumer, into buffers registered with the kernel once
+ *	and recycled as soon as they are consumed. An output queues writes
+ *	and submits them in batches, with several in flight.
+ *
+ *	Both work on regular files only, at explicit offsets starting from
+ *	the current offset of the descriptor. The open functions return NULL
+ *	when io_uring can't be used (old kernel, disabled by the system, a
+ *	pipe, an O_APPEND descriptor): the caller then uses read()/write().
+ */
+#ifndef URING_H
+#define URING_H
+
+#include <sys/types.h>
+
+typedef struct uring_input uring_input;
+typedef struct uring_output uring_output;
+
+/* reads fd with depth reads of chunk bytes in flight */
+uring_input *uring_input_open(int fd, int depth, size_t chunk);
+
+/* like read(2): up to len bytes, 0 at the end of the file, -1 and errno on error */
+ssize_t uring_input_read(uring_input *in, void *buf, size_t len);
+
+void uring_input_close(uring_input *in);
+
+/* called once a queued write is complete */
+typedef void (*uring_done_fn)(void *arg);
+
+/* writes to fd with up to depth writes in flight */
+uring_output *uring_output_open(int fd, int depth);
+
+/*
+   Queues a write of len bytes of buf after the previous ones. buf must
+   stay valid until done(arg) is called, if done is not NULL. Waits if
+   depth writes are in flight. Exits on write errors.
+ */
+void uring_output_write(uring_output *out, const void *buf, size_t len,
+			uring_done_fn done, void *arg);
+
+/* submits the queued writes and reaps the finished ones, without waiting */
+void uring_output_submit(uring_output *out);
+
+/*
+   Waits for all the writes, leaves the file offset of fd after them and
+   frees out.
+ */
+void uring_output_close(uring_output *out);
+
+#endif
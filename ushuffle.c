@@ -32,258 +32,364 @@
  */
 
 #include <ctype.h>
+#include <limits.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "ushuffle.h"
+#include "packdna.h"
+#include "umem.h"
 
-/* set random function */
+/* set random function (of the calling thread) */
 
-static randfunc_t randfunc = random;
+static __thread randfunc_t randfunc = random;
 
 void set_randfunc(randfunc_t func) {
 	randfunc = func;
 }
 
-/* global variables for the Euler algorithm */
+/*
+ * uniform draw in [0,n).
+ * randfunc() only returns 31 random bits, so a plain modulo is biased once
+ * n gets large. Small ranges keep the original modulo draw (bias below
+ * 2^-15, and the output for a given seed stays the same as before); large
+ * ranges combine three draws into 64 bits and reject the biased tail.
+ */
+#define RANDRANGE_SMALL	(1UL << 16)
+
+static unsigned long randrange(unsigned long n) {
+	unsigned long r, lim;
+
+	if (n <= RANDRANGE_SMALL)
+		return (unsigned long) (*randfunc)() % n;
+	lim = -n % n;	/* 2^64 mod n */
+	do {
+		r = (unsigned long) (*randfunc)();
+		r = (r << 31) ^ (unsigned long) (*randfunc)();
+		r = (r << 31) ^ (unsigned long) (*randfunc)();
+	} while (r < lim);
+	return r % n;
+}
 
-static const char *s_ = NULL;
-static int l_ = 0;
-static int k_ = 0;
+/*
+ * global variables for the Euler algorithm, one set per thread so that
+ * threads can shuffle different sequences at the same time
+ */
 
-typedef struct vertex {
-	int *indices;
-	int n_indices;
-	int i_indices;
-	int intree, next;
-	int i_sequence;
-} vertex;
+static __thread const char *s_ = NULL;
+static __thread long l_ = 0;
+static __thread int k_ = 0;
 
-static vertex *vertices = NULL;
-static int n_vertices;
-static int *indices = NULL;
-static int root;
+/*
+ * packed 2-bit source (shuffle1_packed) and destination (shuffle2_packed).
+ * Positions seen by the Euler algorithm are relative to p_off_ / t_off_.
+ */
+static __thread const unsigned char *p_ = NULL;
+static __thread long p_off_ = 0;
+static __thread unsigned char *t_ = NULL;
+static __thread long t_off_ = 0;
+
+/* the i-th symbol of the source sequence */
+static inline char sym(long i) {
+	if (p_)
+		return packdna_base[packdna_get(p_, p_off_ + i)];
+	return s_[i];
+}
 
+/* compare the (k-1)-lets starting at a and b, zero if equal */
+static inline int letcmp(long a, long b) {
+	int i, d;
 
-void shuffle_reset()
-{
-	s_ = NULL ;
-	l_ = 0 ;
-	k_ = 0 ;
-	free(vertices);
-	vertices = NULL ;
-	n_vertices = 0;
-	free(indices);
-	indices = NULL;
-	root = 0 ;
+	if (!p_) {	/* short lets: cheaper than a call to memcmp() */
+		for (i = 0; i < k_ - 1; i++)
+			if ((d = (unsigned char) s_[a + i] - (unsigned char) s_[b + i]) != 0)
+				return d;
+		return 0;
+	}
+	for (i = 0; i < k_ - 1; i++)
+		if ((d = packdna_get(p_, p_off_ + a + i) - packdna_get(p_, p_off_ + b + i)) != 0)
+			return d;
+	return 0;
 }
 
-/* memory utility */
-
-static void *malloc0(size_t size) {
-	void *mem;
+/* write source symbol j to position i of the output */
+static inline void emit(char *t, long i, long j) {
+	if (!t_)
+		t[i] = sym(j);
+	else if (p_)
+		packdna_set(t_, t_off_ + i, packdna_get(p_, p_off_ + j));
+	else
+		packdna_set(t_, t_off_ + i, packdna_code(s_[j]) & 3);
+}
 
-	if ((mem = malloc(size)) == NULL) {
-		fprintf(stderr, "malloc0: malloc failed\n");
-		exit(1);
-	}
-	return memset(mem, 0, size);
+/* write symbol c to position i of the output */
+static inline void emitc(char *t, long i, char c) {
+	if (!t_)
+		t[i] = c;
+	else
+		packdna_set(t_, t_off_ + i, packdna_code(c) & 3);
 }
 
-/* hashtable utility */
+/*
+ * hash code of a (k-1)-let: a polynomial over its symbols, so that the
+ * code of the next let can be rolled forward in constant time.
+ */
+#define HMULT 0x100000001b3UL
 
-typedef struct hentry {
-	struct hentry *next;
-	int i_sequence;
-	int i_vertices;
-} hentry;
+static __thread unsigned long hpow;	/* HMULT^(k-2) */
 
-static hentry *entries = NULL;
-static hentry **htable = NULL;
-static int htablesize = 0;
-static double hmagic;
+static __thread int reproducible_ = 0;	/* see set_shuffle_reproducible() */
 
-static int hcode(int i_sequence) {
-	double f = 0.0;
-	int i;
+static unsigned long hcode(long i) {
+	unsigned long h = 0;
+	int j;
 
-	for (i = 0; i < k_ - 1; i++) {
-		f += s_[i_sequence + i];
-		f *= hmagic;
-	}
-	if (f < 0.0)
-		f = -f;
-	return (int) (htablesize * f) % htablesize;
+	for (j = 0; j < k_ - 1; j++)
+		h = h * HMULT + (unsigned char) sym(i + j);
+	return h;
 }
 
-static void hinit(int size) {
-	entries = malloc0(size * sizeof(hentry));
-	htable = malloc0(size * sizeof(hentry *));
-	htablesize = size;
-	hmagic = (sqrt(5.0) - 1.0) / 2.0;
+/* code of the let at i + 1, given the code h of the let at i */
+static inline unsigned long hroll(unsigned long h, long i) {
+	h -= (unsigned char) sym(i) * hpow;
+	return h * HMULT + (unsigned char) sym(i + k_ - 1);
 }
 
-static void hcleanup() {
-	free(entries);
-	entries = NULL;
-	free(htable);
-	htable = NULL;
-	htablesize = 0;
+/* spread the bits of a hash code, for the slots and the sort keys */
+static inline unsigned long hmix(unsigned long h) {
+	h ^= h >> 31;
+	h *= 0x7fb5d329728ea185UL;
+	h ^= h >> 27;
+	return h;
 }
 
-static void hinsert(int i_sequence) {
-	int code = hcode(i_sequence);
-	hentry *e, *e2 = &entries[i_sequence];
+static inline size_t hslot(unsigned long h, size_t size) {
+	return hmix(h) & (size - 1);
+}
 
-	for (e = htable[code]; e; e = e->next)
-		if (strncmp(&s_[e->i_sequence], &s_[i_sequence], k_ - 1) == 0) {
-			e2->i_sequence = e->i_sequence;
-			e2->i_vertices = e->i_vertices;
-			return;
-		}
-	e2->i_sequence = i_sequence;
-	e2->i_vertices = n_vertices++;
-	e2->next = htable[code];
-	htable[code] = e2;
+/*
+ * graphs of up to HASH_ALWAYS bytes of edges are always built with the
+ * hashtable, whatever their number of distinct lets: it is faster than
+ * sorting them, and numbers the vertices as the original code did, so
+ * that the output for a given seed stays the same. Only longer sequences
+ * fall back to the sort to keep the bound on memory per base.
+ */
+#define HASH_ALWAYS	(1UL << 20)
+
+/*
+ * The Euler algorithm is compiled three times: with 32-bit indices for
+ * sequences that fit (half the memory and cache footprint of the graph),
+ * with 64-bit positions but 32-bit vertex numbers for sequences of up to
+ * 2^32 bases, and with 64-bit indices throughout beyond that.
+ */
+#define PIDX int
+#define VIDX int
+#define EU(name) name##_32
+#include "ushuffle_euler.h"
+#undef PIDX
+#undef VIDX
+#undef EU
+
+#define PIDX long
+#define VIDX unsigned int
+#define EU(name) name##_64v32
+#include "ushuffle_euler.h"
+#undef PIDX
+#undef VIDX
+#undef EU
+
+#define PIDX long
+#define VIDX long
+#define EU(name) name##_64
+#include "ushuffle_euler.h"
+#undef PIDX
+#undef VIDX
+#undef EU
+
+#ifdef USHUFFLE_FORCE_WIDE
+static int width_ = 64;
+#else
+static int width_ = 0;	/* 0 = choose by sequence length */
+#endif
+static __thread int wide_ = 0;	/* engine used by the last shuffle1(): 0, 1 or 2 */
+static __thread shuffle_mem mem_;
+
+void set_shuffle_width(int bits) {
+	width_ = bits;
 }
 
-/* the Euler algorithm */
+void set_shuffle_reproducible(int on) {
+	reproducible_ = on;
+}
 
-void shuffle1(const char *s, int l, int k) {
-	int i, j, n_lets;
+int shuffle_width() {
+	return wide_ ? 64 : 32;
+}
+
+void shuffle_memstats(shuffle_mem *m) {
+	*m = mem_;
+}
+
+void shuffle_reset()
+{
+	s_ = NULL ;
+	p_ = NULL ;
+	l_ = 0 ;
+	k_ = 0 ;
+	reset_32();
+	reset_64v32();
+	reset_64();
+	wide_ = 0 ;
+}
+
+static void shuffle1_any(const char *s, long l, int k) {
+	size_t base, base_huge;
+	int i;
 
 	s_ = s;
 	l_ = l;
 	k_ = k;
+	memset(&mem_, 0, sizeof(mem_));
+	mem_.length = l_;
 	if (k_ >= l_ || k_ <= 1)	/* two special cases */
 		return;
 
-	/* use hashtable to find distinct vertices */
-	n_lets = l_ - k_ + 2;	/* number of (k-1)-lets */
-	n_vertices = 0;
-	hinit(n_lets);
-	for (i = 0; i < n_lets; i++)
-		hinsert(i);
-	root = entries[n_lets - 1].i_vertices;	/* the last let */
-	if (vertices)
-		free(vertices);
-	vertices = malloc0(n_vertices * sizeof(vertex));
-
-	/* set i_sequence and n_indices for each vertex */
-	for (i = 0; i < n_lets; i++) {	/* for each let */
-		hentry *ev = &entries[i];
-		vertex *v = &vertices[ev->i_vertices];
-
-		v->i_sequence = ev->i_sequence;
-		if (i < n_lets - 1)	/* not the last let */
-			v->n_indices++;
-	}
-
-	/* distribute indices for each vertex */
-	if (indices)
-		free(indices);
-	indices = malloc0((n_lets - 1) * sizeof(int));
-	j = 0;
-	for (i = 0; i < n_vertices; i++) {	/* for each vertex */
-		vertex *v = &vertices[i];
-
-		v->indices = indices + j;
-		j += v->n_indices;
+	for (i = 0, hpow = 1; i < k_ - 2; i++)
+		hpow *= HMULT;
+	reset_32();
+	reset_64v32();
+	reset_64();
+	base = umem_current();	/* what the caller holds, input included */
+	base_huge = umem_current_huge();
+	umem_reset_peak();
+	if (l_ >= UINT_MAX) {
+		wide_ = 2;
+		shuffle1_64();
+		mem_.n_vertices = n_vertices_64;
+	} else if (width_ == 64 || l_ >= INT_MAX) {
+		wide_ = 1;
+		shuffle1_64v32();
+		mem_.n_vertices = n_vertices_64v32;
+	} else {
+		wide_ = 0;
+		shuffle1_32();
+		mem_.n_vertices = n_vertices_32;
 	}
+	mem_.peak = umem_peak() - base;
+	mem_.graph = umem_current() - base;
+	mem_.huge = umem_current_huge() - base_huge;
+}
 
-	/* populate indices for each vertex */
-	for (i = 0; i < n_lets - 1; i++) {	/* for each edge */
-		hentry *eu = &entries[i];
-		hentry *ev = &entries[i + 1];
-		vertex *u = &vertices[eu->i_vertices];
+void shuffle1(const char *s, long l, int k) {
+	p_ = NULL;
+	p_off_ = 0;
+	shuffle1_any(s, l, k);
+}
 
-		u->indices[u->i_indices++] = ev->i_vertices;
-	}
-	hcleanup();
+void shuffle1_packed(const unsigned char *s, long offset, long l, int k) {
+	p_ = s;
+	p_off_ = offset;
+	shuffle1_any(NULL, l, k);
 }
 
-void permutec(char *t, int l) {
-	int i, j;
+void permutec(char *t, long l) {
+	long i, j;
 	char tmp;
 
 	for (i = l - 1; i > 0; i--) {
-		j = (*randfunc)() % (i + 1);
+		j = randrange(i + 1);
 		tmp = t[i]; t[i] = t[j]; t[j] = tmp;	/* swap */
 	}
 }
 
-static void permutei(int *t, int l) {
-	int i, j;
+static void permutep(unsigned char *t, long off, long l) {
+	long i, j;
 	int tmp;
 
 	for (i = l - 1; i > 0; i--) {
-		j = (*randfunc)() % (i + 1);
-		tmp = t[i]; t[i] = t[j]; t[j] = tmp;	/* swap */
+		j = randrange(i + 1);
+		tmp = packdna_get(t, off + i);	/* swap */
+		packdna_set(t, off + i, packdna_get(t, off + j));
+		packdna_set(t, off + j, tmp);
 	}
 }
 
-void shuffle2(char *t) {
-	vertex *u, *v;
-	int i, j;
+static void shuffle2_any(char *t) {
+	long i;
 
 	/* exact copy case */
 	if (k_ >= l_) {
-		strncpy(t, s_, l_);
+		if (!p_ && !t_)
+			strncpy(t, s_, l_);
+		else
+			for (i = 0; i < l_; i++)
+				emit(t, i, i);
 		return;
 	}
 
 	/* simple permutation case */
 	if (k_ <= 1) {
-		strncpy(t, s_, l_);
-		permutec(t, l_);
+		if (!p_ && !t_) {
+			strncpy(t, s_, l_);
+			permutec(t, l_);
+		} else {
+			for (i = 0; i < l_; i++)
+				emit(t, i, i);
+			if (t_)
+				permutep(t_, t_off_, l_);
+			else
+				permutec(t, l_);
+		}
 		return;
 	}
 
-	/* the Wilson algorithm for random arborescence */
-	for (i = 0; i < n_vertices; i++)
-		vertices[i].intree = 0;
-	vertices[root].intree = 1;
-	for (i = 0; i < n_vertices; i++) {
-		u = &vertices[i];
-		while (!u->intree) {
-			u->next = (*randfunc)() % u->n_indices;
-			u = &vertices[u->indices[u->next]];
-		}
-		u = &vertices[i];
-		while (!u->intree) {
-			u->intree = 1;
-			u = &vertices[u->indices[u->next]];
-		}
-	}
+	if (wide_ == 2)
+		shuffle2_64(t);
+	else if (wide_ == 1)
+		shuffle2_64v32(t);
+	else
+		shuffle2_32(t);
+}
 
-	/* shuffle indices to prepare for walk */
-	for (i = 0; i < n_vertices; i++) {
-		u = &vertices[i];
-		if (i != root) {
-			j = u->indices[u->n_indices - 1];	/* swap the last one */
-			u->indices[u->n_indices - 1] = u->indices[u->next];
-			u->indices[u->next] = j;
-			permutei(u->indices, u->n_indices - 1);	/* permute the rest */
-		} else
-			permutei(u->indices, u->n_indices);
-		u->i_indices = 0;	/* reset to zero before walk */
-	}
+void shuffle2(char *t) {
+	t_ = NULL;
+	shuffle2_any(t);
+}
+
+void shuffle2_packed(unsigned char *t, long offset) {
+	t_ = t;
+	t_off_ = offset;
+	shuffle2_any(NULL);
+	t_ = NULL;
+}
 
-	/* walk the graph */
-	strncpy(t, s_, k_ - 1);	/* the first let remains the same */
-	u = &vertices[0];
-	i = k_ - 1;
-	while (u->i_indices < u->n_indices) {
-		v = &vertices[u->indices[u->i_indices]];
-		j = v->i_sequence + k_ - 2;
-		t[i++] = s_[j];
-		u->i_indices++;
-		u = v;
+double shuffle_count_log10(long max_vertices) {
+	long counts[256] = { 0 }, i;
+	double logc;
+
+	if (k_ >= l_)	/* copy */
+		return 0;
+	if (k_ <= 1) {	/* permutation: the multinomial of the letter counts */
+		for (i = 0; i < l_; i++)
+			counts[(unsigned char) sym(i)]++;
+		logc = lgamma(l_ + 1);
+		for (i = 0; i < 256; i++)
+			logc -= lgamma(counts[i] + 1);
+		return logc / M_LN10;
 	}
+	if (mem_.n_vertices > max_vertices)
+		return -1;
+	if (wide_ == 2)
+		logc = count_log10_64();
+	else if (wide_ == 1)
+		logc = count_log10_64v32();
+	else
+		logc = count_log10_32();
+	return fabs(logc) < 1e-9 ? 0 : logc;	/* rounding */
 }
 
-void shuffle(const char *s, char *t, int l, int k) {
+void shuffle(const char *s, char *t, long l, int k) {
 	shuffle1(s, l, k);
 	shuffle2(t);
 }
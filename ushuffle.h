@@ -31,13 +31,75 @@
  *	Mon Apr 23 14:35:21 MDT 2007
  */
 
-void shuffle(const char *s, char *t, int l, int k);
-void shuffle1(const char *s, int l, int k);
+void shuffle(const char *s, char *t, long l, int k);
+void shuffle1(const char *s, long l, int k);
 void shuffle2(char *t);
 
+/*
+ * packed 2-bit variants (see packdna.h): shuffle1_packed() reads l bases
+ * starting at base offset of s, which must be pure ACGT. After it, either
+ * shuffle2() writes ASCII, or shuffle2_packed() writes l packed bases
+ * starting at base offset of t.
+ */
+void shuffle1_packed(const unsigned char *s, long offset, long l, int k);
+void shuffle2_packed(unsigned char *t, long offset);
+
+/*
+ * The graph built by shuffle1() and the random function are per thread:
+ * each thread shuffles its own sequence, and set_randfunc() only applies
+ * to the calling thread (the default is random()).
+ */
 typedef long (*randfunc_t)();
 void set_randfunc(randfunc_t randfunc);
 
-void permutec(char *t, int l);	/* for use by test.c */
+void permutec(char *t, long l);	/* for use by test.c */
 
 void shuffle_reset();
+
+/*
+ * index width of the Euler graph: 0 (default) uses 32-bit indices, 64-bit
+ * positions with 32-bit vertex numbers for sequences of 2^31 bases or
+ * more, and 64-bit indices throughout from 2^32 bases. 64 uses 64-bit
+ * positions for all sequences, the vertex numbers staying 32-bit below
+ * 2^32 bases. Building with -DUSHUFFLE_FORCE_WIDE makes 64 the default.
+ * shuffle_width() reports 64 if the last shuffle1() used 64-bit positions.
+ */
+void set_shuffle_width(int bits);
+int shuffle_width();
+
+/*
+ * By default each shuffle2() continues from the edge order left by the
+ * previous one, so a result depends on all the draws since shuffle1().
+ * When on (for the calling thread), shuffle1() and every shuffle2() sort
+ * the out-edges of each vertex back into one canonical order, so that
+ * each shuffle2() starts from it: the result then only depends on the
+ * draws made during that shuffle2(). It takes no extra memory, but a
+ * radix sort of the edges per shuffle2().
+ */
+void set_shuffle_reproducible(int on);
+
+/*
+ * memory accounting of the last shuffle1(): peak is the largest number
+ * of bytes the engine held while building the graph, graph what it keeps
+ * for shuffle2(). Neither includes the input and output sequences, nor
+ * anything else the caller holds through umem. huge is the part of graph
+ * mapped on huge pages (see umem_set_hugepages()). All three are 0 when
+ * k <= 1 or k >= length, which build no graph.
+ */
+typedef struct shuffle_mem {
+	long length;
+	long n_vertices;
+	unsigned long peak;
+	unsigned long graph;
+	unsigned long huge;
+} shuffle_mem;
+
+void shuffle_memstats(shuffle_mem *m);
+
+/*
+ * log10 of the number of distinct sequences (the input included) that
+ * shuffle2() can produce after the last shuffle1(), or -1 when the graph
+ * has more than max_vertices vertices: the count takes O(n^3) time and
+ * O(n^2) memory in the number n of distinct (k-1)-lets.
+ */
+double shuffle_count_log10(long max_vertices);
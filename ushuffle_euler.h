@@ -0,0 +1,605 @@
+/* Copyright (c) 2007
+ *   Minghui Jiang, James Anderson, Joel Gillespie, and Martin Mayne.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *      this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ * 3. The names of its contributors may not be used to endorse or promote
+ *      products derived from this software without specific prior written
+ *      permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ *	ushuffle_euler.h - the Euler algorithm, instantiated per index width
+ *
+ *	This file is not a regular header: ushuffle.c includes it once for
+ *	each index layout, with PIDX set to the integer type used for sequence
+ *	positions and edge counts, VIDX to the type used for vertex numbers,
+ *	and EU(name) set to append the matching suffix to every symbol
+ *	defined here.
+ *
+ *	Memory: the graph is one VIDX per edge (one edge per base) plus one
+ *	PIDX per distinct (k-1)-let. shuffle1() finds the lets with a
+ *	hashtable as long as the table and the vertices take no more room
+ *	than the edges; with more distinct lets than that it sorts pairs of
+ *	VIDX, one pair per let, instead. Either way the peak stays within
+ *	sizeof(VIDX) + sizeof(PIDX) bytes per base: 8 with 32-bit indices,
+ *	12 and 16 with the 64-bit ones. Graphs of up to HASH_ALWAYS bytes of
+ *	edges (256k bases with 32-bit indices) always use the hashtable and
+ *	may take up to about 20 bytes per base (28 with 64-bit positions).
+ *	shuffle_memstats() reports the figures. All of these arrays are
+ *	read and written in random order (sorts, hashing, random walks):
+ *	spilled to files by umem, they are paged, not streamed.
+ */
+
+/*
+ * The out-edges of vertex v run from first[v] to first[v + 1], and
+ * first[n_vertices] is n_edges. A vertex in the random tree of
+ * shuffle2() has its first complemented (negative).
+ *
+ * Hashed graphs keep a position of the let of every vertex in reps and
+ * the edge to the parent in the random tree in tree. Sorted graphs have
+ * neither: their vertices are numbered in the order of the last symbol
+ * of their let, syms[i] being that of the vertices from sym_first[i],
+ * and the edge to the parent is moved to the front of the out-edges.
+ */
+static __thread PIDX *EU(first) = NULL;
+static __thread PIDX *EU(reps) = NULL;
+static __thread PIDX *EU(tree) = NULL;
+static __thread VIDX EU(n_vertices);
+static __thread size_t EU(vertices_alloc) = 0;
+static __thread VIDX *EU(indices) = NULL;
+static __thread PIDX EU(n_edges) = 0;
+static __thread VIDX EU(start);	/* the first let */
+static __thread VIDX EU(root);	/* the last let */
+static __thread int EU(n_syms);
+static __thread char EU(syms)[256];
+static __thread VIDX EU(sym_first)[256];
+
+/* hashtable utility: open addressing on vertex number + 1, 0 is empty */
+
+static __thread VIDX *EU(htable) = NULL;
+static __thread size_t EU(htablesize) = 0;	/* a power of two */
+
+static void EU(hcleanup)() {
+	umem_free(EU(htable), EU(htablesize) * sizeof(VIDX));
+	EU(htable) = NULL;
+	EU(htablesize) = 0;
+}
+
+static void EU(reset)() {
+	if (EU(first))
+		umem_free(EU(first), (EU(vertices_alloc) + 1) * sizeof(PIDX));
+	umem_free(EU(reps), EU(vertices_alloc) * sizeof(PIDX));
+	umem_free(EU(tree), EU(vertices_alloc) * sizeof(PIDX));
+	EU(first) = EU(reps) = EU(tree) = NULL;
+	EU(vertices_alloc) = 0;
+	EU(n_vertices) = 0;
+	umem_free(EU(indices), EU(n_edges) * sizeof(VIDX));
+	EU(indices) = NULL;
+	EU(n_edges) = 0;
+	EU(start) = EU(root) = 0;
+	EU(hcleanup)();
+}
+
+/*
+ * whether vertices and a hashtable of these sizes take no more than the
+ * edges, or the edges no more than HASH_ALWAYS
+ */
+static int EU(hfits)(size_t valloc, size_t hsize) {
+	size_t edges = (size_t) EU(n_edges) * sizeof(VIDX);
+
+	return edges <= HASH_ALWAYS
+		|| (2 * valloc + 1) * sizeof(PIDX) + hsize * sizeof(VIDX) <= edges;
+}
+
+static void EU(hresize)(size_t size) {
+	size_t slot;
+	VIDX v;
+
+	EU(hcleanup)();
+	EU(htable) = umem_alloc(size * sizeof(VIDX));
+	EU(htablesize) = size;
+	for (v = 0; v < EU(n_vertices); v++) {
+		slot = hslot(hcode(EU(reps)[v]), size);
+		while (EU(htable)[slot])
+			slot = (slot + 1) & (size - 1);
+		EU(htable)[slot] = v + 1;
+	}
+}
+
+/*
+ * the vertex of the let at i_sequence with hash code h, added if new;
+ * 0 if adding it would break hfits()
+ */
+static int EU(hinsert)(unsigned long h, PIDX i_sequence, VIDX *vp) {
+	size_t slot = hslot(h, EU(htablesize));
+	VIDX v;
+
+	for (; (v = EU(htable)[slot]) != 0; slot = (slot + 1) & (EU(htablesize) - 1))
+		if (letcmp(EU(reps)[v - 1], i_sequence) == 0) {
+			*vp = v - 1;
+			return 1;
+		}
+
+	if ((size_t) EU(n_vertices) == EU(vertices_alloc)) {
+		size_t n = EU(vertices_alloc) * 2;
+
+		if (n > (size_t) EU(n_edges) + 1)	/* never more vertices than lets */
+			n = EU(n_edges) + 1;
+		if (!EU(hfits)(n, EU(htablesize)))
+			return 0;
+		EU(first) = umem_realloc(EU(first),
+				(EU(vertices_alloc) + 1) * sizeof(PIDX), (n + 1) * sizeof(PIDX));
+		EU(reps) = umem_realloc(EU(reps),
+				EU(vertices_alloc) * sizeof(PIDX), n * sizeof(PIDX));
+		EU(vertices_alloc) = n;
+	}
+	v = EU(n_vertices)++;
+	EU(reps)[v] = i_sequence;
+	EU(htable)[slot] = v + 1;
+	if (2 * (size_t) EU(n_vertices) > EU(htablesize)) {	/* keep load <= 1/2 */
+		if (!EU(hfits)(EU(vertices_alloc), 2 * EU(htablesize)))
+			return 0;
+		EU(hresize)(2 * EU(htablesize));
+	}
+	*vp = v;
+	return 1;
+}
+
+/* offset of the out-edges of v, in the tree or not */
+static inline PIDX EU(edges)(VIDX v) {
+	PIDX f = EU(first)[v];
+
+	return f < 0 ? ~f : f;
+}
+
+/* out-degree of vertex v, once shuffle1() has placed the edges */
+static inline PIDX EU(degree)(VIDX v) {
+	return EU(edges)(v + 1) - EU(edges)(v);
+}
+
+/*
+ * placing the edges of a vertex, and the walk, move its first to that of
+ * the next vertex: move them back
+ */
+static void EU(rewind)() {
+	VIDX v;
+
+	for (v = EU(n_vertices) - 1; v > 0; v--)
+		EU(first)[v] = EU(first)[v - 1];
+	EU(first)[0] = 0;
+}
+
+/* turn counts of out-edges in first into offsets */
+static void EU(offsets)() {
+	PIDX j, n;
+	VIDX v;
+
+	for (v = 0, j = 0; v < EU(n_vertices); v++) {
+		n = EU(first)[v];
+		EU(first)[v] = j;
+		j += n;
+	}
+	EU(first)[EU(n_vertices)] = EU(n_edges);
+}
+
+/* sort key of a record: its first VIDX, unsigned */
+static inline unsigned long EU(key)(const VIDX *r) {
+	return (unsigned long) *r & (~0UL >> (64 - 8 * sizeof(VIDX)));
+}
+
+static inline void EU(swap)(VIDX *a, VIDX *b, int w) {
+	VIDX tmp;
+	int i;
+
+	for (i = 0; i < w; i++) {
+		tmp = a[i]; a[i] = b[i]; b[i] = tmp;
+	}
+}
+
+/* smallest shift that leaves at most 8 bits of n */
+static int EU(topshift)(unsigned long n) {
+	int shift = 0;
+
+	while (n >> shift > 255)
+		shift += 8;
+	return shift;
+}
+
+/*
+ * in-place radix sort (American flag sort) of n records of w VIDX on
+ * their key, from the byte at shift down
+ */
+static void EU(radixsort)(VIDX *a, size_t n, int w, int shift) {
+	size_t count[256] = { 0 }, next[256], end[256], i, j;
+	int b, d;
+
+	if (n <= 32) {	/* insertion sort */
+		for (i = 1; i < n; i++)
+			for (j = i; j > 0 && EU(key)(a + (j - 1) * w) > EU(key)(a + j * w); j--)
+				EU(swap)(a + (j - 1) * w, a + j * w, w);
+		return;
+	}
+	for (i = 0; i < n; i++)
+		count[(EU(key)(a + i * w) >> shift) & 255]++;
+	for (b = 0, j = 0; b < 256; b++) {
+		next[b] = j;
+		j += count[b];
+		end[b] = j;
+	}
+	for (b = 0; b < 256; b++)
+		while (next[b] < end[b]) {
+			d = (EU(key)(a + next[b] * w) >> shift) & 255;
+			if (d == b)
+				next[b]++;
+			else
+				EU(swap)(a + next[b] * w, a + next[d]++ * w, w);
+		}
+	if (shift > 0)
+		for (b = 0, j = 0; b < 256; j += count[b++])
+			if (count[b] > 1)
+				EU(radixsort)(a + j * w, count[b], w, shift - 8);
+}
+
+/* sort n (key, position) pairs by the let at the position */
+static void EU(letsort)(VIDX *a, size_t n) {
+	size_t lt, gt, i;
+	PIDX pivot;
+	int c;
+
+	while (n > 1) {	/* three-way quicksort, recursing on the smaller side */
+		pivot = a[2 * (n / 2) + 1];
+		for (lt = 0, i = 0, gt = n; i < gt; )
+			if ((c = letcmp(a[2 * i + 1], pivot)) < 0)
+				EU(swap)(a + 2 * lt++, a + 2 * i++, 2);
+			else if (c > 0)
+				EU(swap)(a + 2 * --gt, a + 2 * i, 2);
+			else
+				i++;
+		if (lt < n - gt) {
+			EU(letsort)(a, lt);
+			a += 2 * gt;
+			n -= gt;
+		} else {
+			EU(letsort)(a + 2 * gt, n - gt);
+			n = lt;
+		}
+	}
+}
+
+/* sort the out-edges of every vertex: the order reproducible shuffles start from */
+static void EU(canonical)() {
+	int shift = EU(topshift)(EU(n_vertices) - 1);
+	VIDX v;
+
+	for (v = 0; v < EU(n_vertices); v++)
+		EU(radixsort)(EU(indices) + EU(first)[v], EU(degree)(v), 1, shift);
+}
+
+/* the Euler algorithm */
+
+/*
+ * build the graph with a hashtable of the lets; 0 if it would not fit.
+ * Graphs of up to HASH_ALWAYS bytes of edges get their vertices and
+ * table sized for n_lets up front, and keep the vertex of every let in
+ * indices, to place the edges without hashing the lets a second time.
+ */
+static int EU(hbuild)() {
+	PIDX i, n_lets = EU(n_edges) + 1;
+	int small = (size_t) EU(n_edges) * sizeof(VIDX) <= HASH_ALWAYS;
+	VIDX u, v, *lets;
+	unsigned long h;
+	size_t hsize;
+
+	/* first pass: find distinct vertices and count their out-edges */
+	EU(vertices_alloc) = small || n_lets < 1024 ? n_lets : 1024;
+	for (hsize = 16; hsize < 2 * EU(vertices_alloc); hsize *= 2)
+		;
+	if (!EU(hfits)(EU(vertices_alloc), hsize))
+		return 0;
+	EU(first) = umem_alloc((EU(vertices_alloc) + 1) * sizeof(PIDX));
+	EU(reps) = umem_alloc(EU(vertices_alloc) * sizeof(PIDX));
+	EU(indices) = small ? umem_alloc(EU(n_edges) * sizeof(VIDX)) : NULL;
+	EU(hresize)(hsize);
+	h = hcode(0);
+	for (i = 0; i < n_lets; i++) {	/* for each let */
+		if (i > 0)
+			h = hroll(h, i - 1);
+		if (!EU(hinsert)(h, i, &v))
+			return 0;
+		if (small && i > 0)
+			EU(indices)[i - 1] = v;
+		if (i < n_lets - 1)	/* not the last let: count its out-edges in first */
+			EU(first)[v]++;
+		else
+			EU(root) = v;	/* the last let */
+	}
+	if (!small) {
+		EU(first) = umem_realloc(EU(first),
+				(EU(vertices_alloc) + 1) * sizeof(PIDX), (EU(n_vertices) + 1) * sizeof(PIDX));
+		EU(reps) = umem_realloc(EU(reps),
+				EU(vertices_alloc) * sizeof(PIDX), EU(n_vertices) * sizeof(PIDX));
+		EU(vertices_alloc) = EU(n_vertices);
+		if (!EU(hfits)(EU(vertices_alloc), EU(htablesize)))
+			return 0;
+	}
+
+	/* second pass: place the edges of each vertex */
+	EU(offsets)();
+	if (small) {	/* from the lets, copied over the table (2 n_lets slots) */
+		lets = memcpy(EU(htable), EU(indices), EU(n_edges) * sizeof(VIDX));
+		for (i = 0, u = 0; i < n_lets - 1; i++) {	/* for each edge */
+			EU(indices)[EU(first)[u]++] = lets[i];
+			u = lets[i];
+		}
+	} else {
+		EU(indices) = umem_alloc(EU(n_edges) * sizeof(VIDX));
+		h = hcode(0);
+		EU(hinsert)(h, 0, &u);
+		for (i = 0; i < n_lets - 1; i++) {	/* for each edge */
+			h = hroll(h, i);
+			EU(hinsert)(h, i + 1, &v);	/* no new vertex, cannot fail */
+			EU(indices)[EU(first)[u]++] = v;
+			u = v;
+		}
+	}
+	EU(rewind)();
+	EU(hcleanup)();
+	EU(start) = 0;
+	EU(tree) = umem_alloc(EU(vertices_alloc) * sizeof(PIDX));
+	return 1;
+}
+
+/*
+ * build the graph by sorting, in the room of two VIDX per let: (key,
+ * position) pairs of the lets, the key being the last symbol and a hash
+ * of the let, sort into vertices; put back in sequence order, they give
+ * (vertex, next vertex) pairs, which sort into the edges.
+ */
+static void EU(sbuild)() {
+	PIDX i, j, n_lets = EU(n_edges) + 1;
+	int bits = 8 * sizeof(VIDX);
+	unsigned long h, key, last = 0;
+	VIDX *p;
+
+	p = umem_alloc(2 * (size_t) n_lets * sizeof(VIDX));
+	h = hcode(0);
+	for (i = 0; i < n_lets; i++) {
+		if (i > 0)
+			h = hroll(h, i - 1);
+		p[2 * (size_t) i] = (VIDX) ((unsigned long) (unsigned char) sym(i + k_ - 2) << (bits - 8)
+				   | hmix(h) >> (72 - bits));
+		p[2 * (size_t) i + 1] = (VIDX) i;
+	}
+	EU(radixsort)(p, n_lets, 2, bits - 8);
+	for (i = 0; i < n_lets; i = j) {	/* lets of the same key by content */
+		for (j = i + 1; j < n_lets && EU(key)(p + 2 * (size_t) j) == EU(key)(p + 2 * (size_t) i); j++)
+			;
+		if (j - i > 1)
+			EU(letsort)(p + 2 * (size_t) i, j - i);
+	}
+
+	/* number the vertices in place of the keys */
+	EU(n_syms) = 0;
+	for (i = 0; i < n_lets; i++) {
+		key = EU(key)(p + 2 * (size_t) i);
+		if (i == 0 || key != last || letcmp(p[2 * (size_t) i + 1], p[2 * (size_t) i - 1]) != 0) {
+			if (i == 0 || key >> (bits - 8) != last >> (bits - 8)) {
+				EU(syms)[EU(n_syms)] = sym(p[2 * (size_t) i + 1] + k_ - 2);
+				EU(sym_first)[EU(n_syms)++] = EU(n_vertices);
+			}
+			EU(n_vertices)++;
+		}
+		last = key;
+		p[2 * (size_t) i] = EU(n_vertices) - 1;
+		if (p[2 * (size_t) i + 1] == 0)
+			EU(start) = p[2 * (size_t) i];
+		if ((PIDX) p[2 * (size_t) i + 1] == n_lets - 1)
+			EU(root) = p[2 * (size_t) i];
+	}
+
+	/* back in sequence order, then (vertex, next vertex) by vertex */
+	for (i = 0; i < n_lets; i++)
+		while ((PIDX) p[2 * (size_t) i + 1] != i)
+			EU(swap)(p + 2 * (size_t) i, p + 2 * (size_t) p[2 * (size_t) i + 1], 2);
+	for (i = 0; i < n_lets - 1; i++)
+		p[2 * (size_t) i + 1] = p[2 * (size_t) i + 2];
+	EU(radixsort)(p, EU(n_edges), 2, EU(topshift)(EU(n_vertices) - 1));
+
+	/* keep the next vertices, and count the out-edges: the in-edges, one
+	 * more for the first let and one less for the last */
+	for (i = 0; i < EU(n_edges); i++)
+		p[i] = p[2 * (size_t) i + 1];
+	EU(indices) = umem_realloc(p, 2 * (size_t) n_lets * sizeof(VIDX), EU(n_edges) * sizeof(VIDX));
+	EU(vertices_alloc) = EU(n_vertices);
+	EU(first) = umem_alloc((EU(vertices_alloc) + 1) * sizeof(PIDX));
+	for (i = 0; i < EU(n_edges); i++)
+		EU(first)[EU(indices)[i]]++;
+	EU(first)[EU(start)]++;
+	EU(first)[EU(root)]--;
+	EU(offsets)();
+}
+
+static void EU(shuffle1)() {
+	PIDX n_edges = l_ - k_ + 1;	/* one per (k-1)-let but the last */
+
+	EU(reset)();
+	EU(n_edges) = n_edges;
+	if (!EU(hbuild)()) {
+		EU(reset)();
+		EU(n_edges) = n_edges;
+		EU(sbuild)();
+	}
+	if (reproducible_)
+		EU(canonical)();
+}
+
+static void EU(permutei)(VIDX *t, PIDX l) {
+	PIDX i, j;
+	VIDX tmp;
+
+	for (i = l - 1; i > 0; i--) {
+		j = randrange(i + 1);
+		tmp = t[i]; t[i] = t[j]; t[j] = tmp;	/* swap */
+	}
+}
+
+/* the edge from v to its parent in the random tree */
+static inline PIDX EU(parent)(VIDX v) {
+	return EU(edges)(v) + (EU(tree) ? EU(tree)[v] : 0);
+}
+
+/* write the last symbol of the let of v to position i of the output */
+static inline void EU(emitv)(char *t, PIDX i, VIDX v) {
+	int lo = 0, hi = EU(n_syms) - 1, mid;
+
+	if (EU(reps)) {
+		emit(t, i, EU(reps)[v] + k_ - 2);
+		return;
+	}
+	while (lo < hi) {
+		mid = (lo + hi + 1) / 2;
+		if (EU(sym_first)[mid] <= v)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	emitc(t, i, EU(syms)[lo]);
+}
+
+static void EU(shuffle2)(char *t) {
+	VIDX *ind, u, v, w;
+	PIDX i, n, c;
+
+	/* the Wilson algorithm for random arborescence */
+	EU(first)[EU(root)] = ~EU(first)[EU(root)];
+	for (w = 0; w < EU(n_vertices); w++) {
+		for (u = w; EU(first)[u] >= 0; u = EU(indices)[EU(parent)(u)]) {
+			c = randrange(EU(degree)(u));
+			if (EU(tree))
+				EU(tree)[u] = c;
+			else {
+				ind = EU(indices) + EU(first)[u];
+				v = ind[0]; ind[0] = ind[c]; ind[c] = v;
+			}
+		}
+		for (u = w; EU(first)[u] >= 0; u = v) {
+			v = EU(indices)[EU(parent)(u)];
+			EU(first)[u] = ~EU(first)[u];
+		}
+	}
+
+	/* shuffle indices to prepare for walk */
+	for (u = 0; u < EU(n_vertices); u++) {
+		EU(first)[u] = ~EU(first)[u];
+		ind = EU(indices) + EU(first)[u];
+		n = EU(degree)(u);
+		if (u != EU(root)) {
+			c = EU(tree) ? EU(tree)[u] : 0;
+			v = ind[n - 1];	/* swap the last one */
+			ind[n - 1] = ind[c];
+			ind[c] = v;
+			EU(permutei)(ind, n - 1);	/* permute the rest */
+		} else
+			EU(permutei)(ind, n);
+	}
+
+	/* walk the graph */
+	for (i = 0; i < k_ - 1; i++)	/* the first let remains the same */
+		emit(t, i, i);
+	for (u = EU(start); i < l_; i++) {	/* one step per edge */
+		u = EU(indices)[EU(first)[u]++];
+		EU(emitv)(t, i, u);
+	}
+	EU(rewind)();
+	if (reproducible_)
+		EU(canonical)();
+}
+
+/*
+ * log10 of the number of distinct sequences shuffle2() can produce, by
+ * the BEST theorem: the arborescences rooted at the last let (a
+ * determinant of the reduced Laplacian, by Gaussian elimination) times
+ * the orderings of the remaining out-edges of every vertex, divided by
+ * the orderings of parallel edges. O(n_vertices^3) time and
+ * n_vertices^2 doubles of memory.
+ */
+static double EU(count_log10)() {
+	long n = EU(n_vertices), m = n - 1, i, j, r, pivot;
+	double *lap, *cnt, logc = 0, f, tmp;
+	VIDX *ind;
+	PIDX e, d;
+
+	if ((lap = calloc(m > 0 ? m * m : 1, sizeof(double))) == NULL ||
+	    (cnt = calloc(n, sizeof(double))) == NULL) {
+		free(lap);
+		return -1;
+	}
+	/* reduced Laplacian, out-degree minus adjacency, without the root */
+	for (i = 0; i < n; i++) {
+		ind = EU(indices) + EU(first)[i];
+		d = EU(degree)(i);
+		for (e = 0; e < d; e++)
+			cnt[ind[e]]++;
+		for (e = 0; e < d; e++) {
+			j = ind[e];
+			if (cnt[j] == 0)
+				continue;
+			logc -= lgamma(cnt[j] + 1);	/* parallel edges */
+			if (i != EU(root) && j != i) {
+				r = i - (i > EU(root));
+				lap[r * m + r] += cnt[j];
+				if (j != EU(root))
+					lap[r * m + j - (j > EU(root))] -= cnt[j];
+			}
+			cnt[j] = 0;
+		}
+		if (i != EU(root))
+			logc += lgamma(d);	/* (out - 1)! */
+		else
+			logc += lgamma(d + 1);	/* out! */
+	}
+
+	for (i = 0; i < m; i++) {
+		pivot = i;
+		for (r = i + 1; r < m; r++)
+			if (fabs(lap[r * m + i]) > fabs(lap[pivot * m + i]))
+				pivot = r;
+		if (lap[pivot * m + i] == 0) {
+			logc = -INFINITY;	/* not connected, cannot happen */
+			break;
+		}
+		if (pivot != i)
+			for (j = i; j < m; j++) {
+				tmp = lap[i * m + j]; lap[i * m + j] = lap[pivot * m + j]; lap[pivot * m + j] = tmp;
+			}
+		logc += log(fabs(lap[i * m + i]));
+		for (r = i + 1; r < m; r++) {
+			f = lap[r * m + i] / lap[i * m + i];
+			if (f != 0)
+				for (j = i; j < m; j++)
+					lap[r * m + j] -= f * lap[i * m + j];
+		}
+	}
+	free(lap);
+	free(cnt);
+	return logc / M_LN10;
+}
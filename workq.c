@@ -0,0 +1,162 @@
+/*
+   workq - work-stealing thread pool of fasta_ushuffle.
+
+   Released under the same license as uShuffle (see README).
+ */
+
+/*
+ *	workq.c - worker threads with per-thread deques and work stealing
+ */
+#include <stdlib.h>
+#include <errno.h>
+#include <err.h>
+#include <pthread.h>
+#include "workq.h"
+
+typedef struct deque {
+	pthread_mutex_t lock;
+	void **tasks;	/* circular, capacity slots */
+	int head;	/* oldest task */
+	int count;
+} deque;
+
+typedef struct worker {
+	workq *q;
+	int id;
+	pthread_t thread;
+} worker;
+
+struct workq {
+	int n_workers;
+	int capacity;
+	workq_fn fn;
+	deque *deques;
+	worker *workers;
+	int next;		/* deque of the next submitted task */
+
+	pthread_mutex_t lock;	/* idle workers wait here */
+	pthread_cond_t ready;
+	long queued;		/* tasks in all deques: atomic, taken without lock */
+	int finishing;
+};
+
+static void *take(workq *q, int d)
+{
+	deque *dq = &q->deques[d];
+	void *task = NULL;
+
+	pthread_mutex_lock(&dq->lock);
+	if (dq->count > 0) {
+		task = dq->tasks[dq->head];
+		dq->head = (dq->head + 1) % q->capacity;
+		dq->count--;
+	}
+	pthread_mutex_unlock(&dq->lock);
+	return task;
+}
+
+/* the oldest task of our own deque, or else of the first deque that has one */
+static void *next_task(workq *q, int id)
+{
+	void *task;
+	int i;
+
+	for (i = 0; i < q->n_workers; i++)
+		if ((task = take(q, (id + i) % q->n_workers)) != NULL) {
+			__atomic_sub_fetch(&q->queued, 1, __ATOMIC_SEQ_CST);
+			return task;
+		}
+	return NULL;
+}
+
+static void *worker_main(void *arg)
+{
+	worker *w = arg;
+	workq *q = w->q;
+	void *task;
+
+	for (;;) {
+		if ((task = next_task(q, w->id)) != NULL) {
+			q->fn(task, w->id);
+			continue;
+		}
+		pthread_mutex_lock(&q->lock);
+		while (__atomic_load_n(&q->queued, __ATOMIC_SEQ_CST) <= 0 && !q->finishing)
+			pthread_cond_wait(&q->ready, &q->lock);
+		if (__atomic_load_n(&q->queued, __ATOMIC_SEQ_CST) <= 0 && q->finishing) {
+			pthread_mutex_unlock(&q->lock);
+			break;
+		}
+		pthread_mutex_unlock(&q->lock);
+	}
+	return NULL;
+}
+
+workq *workq_create(int n_workers, int capacity, workq_fn fn)
+{
+	workq *q;
+	int i, rc;
+
+	if ((q = calloc(1, sizeof(workq)))==NULL
+	    || (q->deques = calloc(n_workers, sizeof(deque)))==NULL
+	    || (q->workers = calloc(n_workers, sizeof(worker)))==NULL)
+		err(1,"calloc failed");
+	q->n_workers = n_workers;
+	q->capacity = capacity;
+	q->fn = fn;
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->ready, NULL);
+	for (i = 0; i < n_workers; i++) {
+		pthread_mutex_init(&q->deques[i].lock, NULL);
+		if ((q->deques[i].tasks = malloc(capacity * sizeof(void *)))==NULL)
+			err(1,"malloc failed");
+	}
+	for (i = 0; i < n_workers; i++) {
+		q->workers[i].q = q;
+		q->workers[i].id = i;
+		if ((rc = pthread_create(&q->workers[i].thread, NULL, worker_main, &q->workers[i]))!=0) {
+			errno = rc;
+			err(1,"pthread_create failed");
+		}
+	}
+	return q;
+}
+
+void workq_submit(workq *q, void *task)
+{
+	deque *dq = &q->deques[q->next];
+
+	q->next = (q->next + 1) % q->n_workers;
+	pthread_mutex_lock(&dq->lock);
+	if (dq->count == q->capacity)
+		errx(1,"workq: more than %d tasks queued", q->capacity);
+	dq->tasks[(dq->head + dq->count) % q->capacity] = task;
+	dq->count++;
+	pthread_mutex_unlock(&dq->lock);
+
+	pthread_mutex_lock(&q->lock);
+	__atomic_add_fetch(&q->queued, 1, __ATOMIC_SEQ_CST);
+	pthread_cond_signal(&q->ready);
+	pthread_mutex_unlock(&q->lock);
+}
+
+void workq_finish(workq *q)
+{
+	int i;
+
+	pthread_mutex_lock(&q->lock);
+	q->finishing = 1;
+	pthread_cond_broadcast(&q->ready);
+	pthread_mutex_unlock(&q->lock);
+	for (i = 0; i < q->n_workers; i++)
+		pthread_join(q->workers[i].thread, NULL);
+	for (i = 0; i < q->n_workers; i++) {
+		pthread_mutex_destroy(&q->deques[i].lock);
+		free(q->deques[i].tasks);
+	}
+	pthread_mutex_destroy(&q->lock);
+	pthread_cond_destroy(&q->ready);
+	free(q->deques);
+	free(q->workers);
+	free(q);
+}
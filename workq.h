@@ -0,0 +1,36 @@
+/*
+   workq - work-stealing thread pool of fasta_ushuffle.
+
+   Released under the same license as uShuffle (see README).
+ */
+
+/*
+ *	workq.h - worker threads with per-thread deques and work stealing
+ *
+ *	Submitted tasks are dealt round-robin to the deques of the workers.
+ *	A worker takes the oldest task of its own deque and, when that is
+ *	empty, steals the oldest task of another worker's deque, so an idle
+ *	worker never waits while tasks are queued anywhere. Oldest-first on
+ *	both sides keeps completion close to submission order, which bounds
+ *	the reorder buffer of the caller.
+ */
+#ifndef WORKQ_H
+#define WORKQ_H
+
+/* runs a task; worker is the number of the calling worker, from 0 */
+typedef void (*workq_fn)(void *task, int worker);
+
+typedef struct workq workq;
+
+/*
+   Starts n_workers threads. At most capacity tasks may be queued at any
+   time: the caller bounds the tasks in flight.
+ */
+workq *workq_create(int n_workers, int capacity, workq_fn fn);
+
+void workq_submit(workq *q, void *task);
+
+/* runs the queued tasks, stops the workers and frees q */
+void workq_finish(workq *q);
+
+#endif